@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <stdexcept>
+#include "KeyCache.h"
+#include "polarssl/blowfish.h"
+#include "polarssl/xtea.h"
+
+using namespace std;
+
+/*  8 bytes ==  64 bits */
+#define XTEA_BLOCK_SIZE 8
+/* 16 bytes == 128 bits */
+#define XTEA_KEY_SIZE  16
+
+/*
+ * Cipher traits for CryptoLog::Log. Each one names the PolarSSL context
+ * and forwards to its functions, so the mode code in Mode.h is written
+ * once for every cipher and the calls resolve at compile time.
+ */
+namespace CryptoLog {
+  struct Blowfish {
+    typedef blowfish_context context;
+    static const size_t block_size = BLOWFISH_BLOCKSIZE;
+    /* Blowfish has no fixed key length, it is always given (see Log) */
+    static const unsigned int key_bits = 0;
+
+    static void init(context *ctx) { blowfish_init(ctx); }
+    static void free(context *ctx) { blowfish_free(ctx); }
+    static void set_key(context *ctx, const unsigned char key[], unsigned int keylen);
+
+    static void encrypt_block(context *ctx, const unsigned char input[], unsigned char output[])
+    {
+      blowfish_crypt_ecb(ctx, BLOWFISH_ENCRYPT, input, output);
+    }
+
+    static void decrypt_block(context *ctx, const unsigned char input[], unsigned char output[])
+    {
+      blowfish_crypt_ecb(ctx, BLOWFISH_DECRYPT, input, output);
+    }
+
+    static void cbc_encrypt(context *ctx, size_t length, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      blowfish_crypt_cbc(ctx, BLOWFISH_ENCRYPT, length, iv, input, output);
+    }
+
+    static void cbc_decrypt(context *ctx, size_t length, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      blowfish_crypt_cbc(ctx, BLOWFISH_DECRYPT, length, iv, input, output);
+    }
+
+    static void cfb_encrypt(context *ctx, size_t length, size_t *iv_off, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      blowfish_crypt_cfb64(ctx, BLOWFISH_ENCRYPT, length, iv_off, iv, input, output);
+    }
+
+    static void cfb_decrypt(context *ctx, size_t length, size_t *iv_off, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      blowfish_crypt_cfb64(ctx, BLOWFISH_DECRYPT, length, iv_off, iv, input, output);
+    }
+
+    static void ctr_crypt(context *ctx, size_t length, size_t *nc_off,
+                          unsigned char nonce_counter[], unsigned char stream_block[],
+                          const unsigned char *input, unsigned char *output)
+    {
+      blowfish_crypt_ctr(ctx, length, nc_off, nonce_counter, stream_block, input, output);
+    }
+  };
+
+  struct XTEA {
+    typedef xtea_context context;
+    static const size_t block_size = XTEA_BLOCK_SIZE;
+    static const unsigned int key_bits = XTEA_KEY_SIZE * 8;
+
+    static void init(context *ctx) { xtea_init(ctx); }
+    static void free(context *ctx) { xtea_free(ctx); }
+    static void set_key(context *ctx, const unsigned char key[], unsigned int keylen);
+
+    static void encrypt_block(context *ctx, const unsigned char input[], unsigned char output[])
+    {
+      xtea_crypt_ecb(ctx, XTEA_ENCRYPT, input, output);
+    }
+
+    static void decrypt_block(context *ctx, const unsigned char input[], unsigned char output[])
+    {
+      xtea_crypt_ecb(ctx, XTEA_DECRYPT, input, output);
+    }
+
+    static void cbc_encrypt(context *ctx, size_t length, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      xtea_crypt_cbc(ctx, XTEA_ENCRYPT, length, iv, input, output);
+    }
+
+    static void cbc_decrypt(context *ctx, size_t length, unsigned char iv[],
+                            const unsigned char *input, unsigned char *output)
+    {
+      xtea_crypt_cbc(ctx, XTEA_DECRYPT, length, iv, input, output);
+    }
+
+    static void ctr_crypt(context *ctx, size_t length, size_t *nc_off,
+                          unsigned char nonce_counter[], unsigned char stream_block[],
+                          const unsigned char *input, unsigned char *output)
+    {
+      xtea_crypt_ctr(ctx, length, nc_off, nonce_counter, stream_block, input, output);
+    }
+  };
+}
+
+void CryptoLog::Blowfish::set_key(context *ctx, const unsigned char key[], unsigned int keylen)
+{
+  if (keylen >= BLOWFISH_MIN_KEY && keylen <= BLOWFISH_MAX_KEY)
+    *ctx = *BlowfishKeyCache::instance().get(key, keylen);
+  else
+    throw runtime_error("Invalid key length");
+}
+
+void CryptoLog::XTEA::set_key(context *ctx, const unsigned char key[], unsigned int keylen)
+{
+  if (keylen == key_bits)
+    xtea_setup(ctx, key);
+  else
+    throw runtime_error("Invalid key length");
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CryptoLog {
+  /*
+   * Moves the non-zero bytes of buff to its front, keeping their order,
+   * and returns how many there are. Used to drop the CBC padding of logs
+   * without framing.
+   */
+  size_t drop_zeros(unsigned char *buff, size_t size);
+}
+
+/*
+ * The padding of a message is its last few bytes, so most 16 byte blocks
+ * hold no zero and are moved as a whole, and the padding blocks are all
+ * zeros and skipped; only the blocks in between are picked byte by byte.
+ */
+size_t CryptoLog::drop_zeros(unsigned char *buff, size_t size)
+{
+  size_t length = 0, i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; i + 16 <= size; i += 16)
+  {
+    __m128i block = _mm_loadu_si128((const __m128i*) (buff + i));
+    unsigned int keep = ~_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) & 0xFFFF;
+
+    if (keep == 0xFFFF)
+    {
+      /* lands at or before where it came from, which is read already */
+      _mm_storeu_si128((__m128i*) (buff + length), block);
+      length += 16;
+    }
+    else if (keep != 0)
+    {
+      unsigned char bytes[16];
+      _mm_storeu_si128((__m128i*) bytes, block);
+      for (; keep != 0; keep &= keep - 1)
+        buff[length++] = bytes[__builtin_ctz(keep)];
+    }
+  }
+#endif
+
+  for (; i < size; i++)
+    if (buff[i] != 0x00)
+      buff[length++] = buff[i];
+
+  return length;
+}
@@ -0,0 +1,470 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "CryptoLog.h"
+#include "Frame.h"
+#include "Log.h"
+
+using namespace std;
+
+/*
+ * A front-end that makes any log safe to write from many threads, e.g.
+ * Concurrent<Blowfish_CBC>. Every thread appends to a staging buffer of
+ * its own; whichever writer finds the log free becomes the combiner,
+ * collects the staged messages of all threads and hands them to the one
+ * cipher state as a single write (flat combining). The others return as
+ * soon as their message is staged. Messages of one thread keep their
+ * order; messages of different threads are ordered as they are combined.
+ * In a framed log (see Log::set_framing()) every message is staged as a
+ * record, so the combined write still reads back message by message.
+ */
+namespace CryptoLog {
+  template <class LogT>
+  class Concurrent final : public CryptoLog {
+    public:
+      template <class... Args>
+      Concurrent(Args&&... args) : log(forward<Args>(args)...), id(next_id()) {}
+      ~Concurrent();
+      virtual void open(const string &filename);
+      virtual void close();
+      virtual void write(const string &str);
+      virtual void write(const char *data, size_t size);
+      void write(const char *str);
+#if __cplusplus >= 201703L
+      void write(string_view str);
+#endif
+      virtual void writev(const struct iovec *iov, int iovcnt);
+      virtual void flush();
+      virtual void sync();
+      void sync(unsigned long long seq);
+      unsigned long long sequence() const { return staged.load(); }
+      virtual string read();
+      virtual string get_plain_text();
+      vector<string> get_records();
+      typename LogT::Reader reader();
+      virtual Concurrent& operator<<(const string &str);
+      Concurrent& operator<<(const char *str);
+#if __cplusplus >= 201703L
+      Concurrent& operator<<(string_view str);
+#endif
+      /* the wrapped log, to configure it before it is shared */
+      LogT& get_log() { return log; }
+    private:
+      struct Slot {
+        thread::id owner;
+        mutex m;
+        string buff;
+        size_t records = 0;
+      };
+
+      /*
+       * Holds the log taken over (see lock()) for a scope. release() hands
+       * it back and reports what the combines it runs throw; if the scope
+       * is left by an exception instead, the destructor hands it back.
+       */
+      class Taken {
+        public:
+          /* taken says the caller took the log over already */
+          explicit Taken(Concurrent &owner, bool taken = false) : c(&owner) { if (!taken) owner.lock(); }
+          ~Taken();
+          void release();
+        private:
+          Concurrent *c;
+      };
+
+      static unsigned long long next_id();
+      Slot* slot();
+      void lock();
+      void unlock();
+      void combine();
+
+      LogT log;
+      /* never reused, so a stale thread-local cache cannot match */
+      const unsigned long long id;
+      mutex slots_mutex;
+      vector<unique_ptr<Slot>> slots;
+      atomic<size_t> pending{0};
+      atomic<bool> combining{false};
+      string batch;
+      /* the number of messages staged so far, the sequence of the last one */
+      atomic<unsigned long long> staged{0};
+      mutex sync_mutex;
+      condition_variable sync_cv;
+      bool syncing = false;
+      unsigned long long durable = 0;
+  };
+}
+
+template <class LogT>
+CryptoLog::Concurrent<LogT>::~Concurrent()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+}
+
+template <class LogT>
+CryptoLog::Concurrent<LogT>::Taken::~Taken()
+{
+  if (c == NULL)
+    return;
+
+  try
+  {
+    c->unlock();
+  }
+  catch (...)
+  {
+  }
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::Taken::release()
+{
+  Concurrent *taken = c;
+  c = NULL;
+  taken->unlock();
+}
+
+template <class LogT>
+unsigned long long CryptoLog::Concurrent<LogT>::next_id()
+{
+  static atomic<unsigned long long> ids{0};
+  return ++ids;
+}
+
+/*
+ * The calling thread's staging slot. The last one used is cached per
+ * thread, which covers the common case of one shared log; otherwise the
+ * slots are searched for the thread's own.
+ */
+template <class LogT>
+typename CryptoLog::Concurrent<LogT>::Slot* CryptoLog::Concurrent<LogT>::slot()
+{
+  static thread_local unsigned long long cached_id = 0;
+  static thread_local void *cached_slot = NULL;
+
+  if (cached_id == id)
+    return static_cast<Slot*>(cached_slot);
+
+  Slot *s = NULL;
+  thread::id self = this_thread::get_id();
+  {
+    lock_guard<mutex> lock(slots_mutex);
+    for (size_t i = 0; i < slots.size() && s == NULL; i++)
+      if (slots[i]->owner == self)
+        s = slots[i].get();
+
+    if (s == NULL)
+    {
+      s = new Slot;
+      s->owner = self;
+      slots.emplace_back(s);
+    }
+  }
+
+  cached_id = id;
+  cached_slot = s;
+
+  return s;
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::lock()
+{
+  while (combining.exchange(true))
+    this_thread::yield();
+}
+
+/*
+ * A writer that staged a message while the combiner was busy counted it
+ * in pending before it failed to take the log over, and both are
+ * sequentially consistent, so the combiner sees it here. The log is handed
+ * back even if one of these combines throws.
+ */
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::unlock()
+{
+  combining.store(false);
+
+  while (pending.load() != 0 && !combining.exchange(true))
+  {
+    try
+    {
+      combine();
+    }
+    catch (...)
+    {
+      combining.store(false);
+      throw;
+    }
+    combining.store(false);
+  }
+}
+
+/*
+ * Called with the log taken over. The staged messages are counted off
+ * pending once they are handed to the log. A batch the log fails to take
+ * is dropped rather than written again in front of the next one; the
+ * error goes to the caller that combined it.
+ */
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::combine()
+{
+  size_t records = 0;
+  string staged;
+
+  {
+    lock_guard<mutex> lock(slots_mutex);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+      Slot *s = slots[i].get();
+      {
+        lock_guard<mutex> slot_lock(s->m);
+        if (s->records == 0)
+          continue;
+        staged.swap(s->buff);
+        records += s->records;
+        s->records = 0;
+      }
+      batch += staged;
+      staged.clear();
+    }
+  }
+
+  if (records == 0)
+    return;
+
+  try
+  {
+    if (log.get_framing())
+      log.write_framed(batch.data(), batch.size());
+    else
+      log.write(batch);
+  }
+  catch (...)
+  {
+    batch.clear();
+    pending.fetch_sub(records);
+    throw;
+  }
+
+  batch.clear();
+  pending.fetch_sub(records);
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::write(const string &str)
+{
+  write(str.data(), str.size());
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::write(const char *str)
+{
+  write(str, strlen(str));
+}
+
+#if __cplusplus >= 201703L
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::write(string_view str)
+{
+  write(str.data(), str.size());
+}
+#endif
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::write(const char *data, size_t size)
+{
+  struct iovec iov = { (void*) data, size };
+  writev(&iov, 1);
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::writev(const struct iovec *iov, int iovcnt)
+{
+  Slot *s = slot();
+  unsigned long long seq;
+  {
+    lock_guard<mutex> lock(s->m);
+    if (log.get_framing())
+    {
+      unsigned char header[FRAME_HEADER_MAX];
+      s->buff.append((const char*) header, frame_header(header, iov_size(iov, iovcnt)));
+    }
+    for (int i = 0; i < iovcnt; i++)
+      s->buff.append((const char*) iov[i].iov_base, iov[i].iov_len);
+    s->records++;
+    /* counted before the combiner can take it, so pending never wraps */
+    pending.fetch_add(1);
+    seq = staged.fetch_add(1) + 1;
+  }
+
+  if (!combining.exchange(true))
+  {
+    Taken taken(*this, true);
+    combine();
+    taken.release();
+  }
+
+  if (log.get_durability() == DURABILITY_PER_WRITE)
+    sync(seq);
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::flush()
+{
+  Taken taken(*this);
+  combine();
+  log.flush();
+  taken.release();
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::sync()
+{
+  sync(staged.load());
+}
+
+/*
+ * Like Log::sync(seq): one caller combines and syncs everything staged so
+ * far while the others wait for it, so concurrent writers share one
+ * fdatasync.
+ */
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::sync(unsigned long long seq)
+{
+  unique_lock<mutex> guard(sync_mutex);
+
+  if (seq > staged.load())
+    seq = staged.load();
+
+  while (durable < seq)
+  {
+    if (syncing)
+    {
+      sync_cv.wait(guard);
+      continue;
+    }
+
+    syncing = true;
+    guard.unlock();
+
+    /* everything counted here is in a slot by now, combine() takes it */
+    unsigned long long target = staged.load();
+    exception_ptr error;
+
+    try
+    {
+      Taken taken(*this);
+      combine();
+      log.sync();
+      taken.release();
+    }
+    catch (...)
+    {
+      error = current_exception();
+    }
+
+    guard.lock();
+    syncing = false;
+    if (!error && durable < target)
+      durable = target;
+    sync_cv.notify_all();
+
+    if (error)
+      rethrow_exception(error);
+  }
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::open(const string &filename)
+{
+  Taken taken(*this);
+  combine();
+  log.open(filename);
+  taken.release();
+}
+
+template <class LogT>
+void CryptoLog::Concurrent<LogT>::close()
+{
+  Taken taken(*this);
+  combine();
+  log.close();
+  taken.release();
+}
+
+template <class LogT>
+string CryptoLog::Concurrent<LogT>::get_plain_text()
+{
+  Taken taken(*this);
+  combine();
+  string plaintext = log.get_plain_text();
+  taken.release();
+
+  return plaintext;
+}
+
+template <class LogT>
+vector<string> CryptoLog::Concurrent<LogT>::get_records()
+{
+  Taken taken(*this);
+  combine();
+  vector<string> records = log.get_records();
+  taken.release();
+
+  return records;
+}
+
+template <class LogT>
+typename LogT::Reader CryptoLog::Concurrent<LogT>::reader()
+{
+  Taken taken(*this);
+  combine();
+  typename LogT::Reader r = log.reader();
+  taken.release();
+
+  return r;
+}
+
+template <class LogT>
+string CryptoLog::Concurrent<LogT>::read()
+{
+  return get_plain_text();
+}
+
+template <class LogT>
+CryptoLog::Concurrent<LogT>& CryptoLog::Concurrent<LogT>::operator<<(const string &str)
+{
+  write(str);
+  return *this;
+}
+
+template <class LogT>
+CryptoLog::Concurrent<LogT>& CryptoLog::Concurrent<LogT>::operator<<(const char *str)
+{
+  write(str);
+  return *this;
+}
+
+#if __cplusplus >= 201703L
+template <class LogT>
+CryptoLog::Concurrent<LogT>& CryptoLog::Concurrent<LogT>::operator<<(string_view str)
+{
+  write(str);
+  return *this;
+}
+#endif
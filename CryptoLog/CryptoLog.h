@@ -1,5 +1,18 @@
 #pragma once
+#include <cstddef>
+#include <cstring>
 #include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if _WIN32
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
 
 using namespace std;
 
@@ -10,9 +23,33 @@ namespace CryptoLog {
       virtual void open(const string &filename) = 0;
       virtual void close() = 0;
       virtual void write(const string &str) = 0;
+      virtual void write(const char *data, size_t size) = 0;
+      /* one message gathered from iovcnt buffers */
+      virtual void writev(const struct iovec *iov, int iovcnt) = 0;
+      virtual void flush() = 0;
+      virtual void sync() = 0;
       virtual string read() = 0;
       virtual string get_plain_text(void) = 0;
       virtual CryptoLog& operator<<(const string &str) = 0;
   };
+
+  size_t iov_size(const struct iovec *iov, int iovcnt);
+  void iov_gather(unsigned char *out, const struct iovec *iov, int iovcnt);
+}
+
+size_t CryptoLog::iov_size(const struct iovec *iov, int iovcnt)
+{
+  size_t size = 0;
+  for (int i = 0; i < iovcnt; i++)
+    size += iov[i].iov_len;
+  return size;
 }
 
+void CryptoLog::iov_gather(unsigned char *out, const struct iovec *iov, int iovcnt)
+{
+  for (int i = 0; i < iovcnt; i++)
+  {
+    memcpy(out, iov[i].iov_base, iov[i].iov_len);
+    out += iov[i].iov_len;
+  }
+}
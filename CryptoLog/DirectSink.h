@@ -0,0 +1,320 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include "Sink.h"
+#if !_WIN32
+#include <fcntl.h>
+#endif
+#if defined(O_DIRECT)
+#define CRYPTOLOG_HAVE_DIRECT 1
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+/* the unit of O_DIRECT writes; offsets, sizes and the buffer are aligned to it */
+#define DIRECT_PAGE_SIZE 4096
+
+/*
+ * A sink that writes with O_DIRECT, so logs that are written once and
+ * rarely read back do not fill the page cache. Appends are staged in an
+ * aligned buffer that starts at a page boundary of the file and go out as
+ * whole pages; the unaligned tail page stays in the buffer. flush() writes
+ * just the bytes of the tail, with O_DIRECT cleared, so the file never
+ * holds more than was appended; the tail goes out again, with O_DIRECT,
+ * once its page is full. The tail page of an existing file is read back
+ * on open().
+ *
+ * The header rewrites and the reads of get_plain_text() are neither
+ * aligned nor worth bypassing the cache for, so they clear O_DIRECT for
+ * their duration too; a rewrite that falls into the staged tail page
+ * patches the buffer as well. On file systems without O_DIRECT the sink
+ * works the same way through the page cache.
+ */
+namespace CryptoLog {
+#if CRYPTOLOG_HAVE_DIRECT
+  class DirectSink : public Sink {
+    public:
+      DirectSink();
+      ~DirectSink();
+      virtual void open(const string &filename);
+      virtual void close();
+      virtual bool is_open() const { return fd != -1; }
+      virtual void append(const void *data, size_t size);
+      virtual void write_at(const void *data, size_t size, uint64_t offset);
+      virtual void read_at(void *data, size_t size, uint64_t offset);
+      virtual void flush();
+      virtual void sync();
+      virtual uint64_t size() { return end; }
+      virtual void set_preallocation(uint64_t chunk) { prealloc.set_chunk(chunk); }
+      virtual int descriptor() const { return fd; }
+    private:
+      void write_pages(size_t size);
+      void write_fully(const unsigned char *data, size_t size, uint64_t offset);
+      void set_direct(bool on);
+      int fd = -1;
+      bool direct = false;
+      string filename;
+      unsigned char *buff;
+      size_t buffered = 0;
+      /* the page the buffer starts at and the logical end of the file */
+      uint64_t buff_offset = 0, end = 0;
+      /* appended to since the tail page was last written */
+      bool dirty = false;
+      Preallocator prealloc;
+  };
+#endif
+
+  Sink* direct_sink();
+}
+
+#if CRYPTOLOG_HAVE_DIRECT
+CryptoLog::DirectSink::DirectSink()
+{
+  void *p;
+  if (posix_memalign(&p, DIRECT_PAGE_SIZE, SINK_BUFFER_SIZE) != 0)
+    throw runtime_error("Could not allocate the sink buffer");
+  buff = (unsigned char*) p;
+}
+
+CryptoLog::DirectSink::~DirectSink()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+  free(buff);
+}
+
+void CryptoLog::DirectSink::open(const string &filename)
+{
+  close();
+
+  direct = true;
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+  if (fd == -1 && errno == EINVAL)
+  {
+    direct = false;
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  }
+  if (fd == -1)
+    throw runtime_error("Could not open file: " + filename);
+
+  this->filename = filename;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    ::close(fd);
+    fd = -1;
+    throw runtime_error("Could not open file: " + filename);
+  }
+
+  end = st.st_size;
+  buff_offset = end & ~((uint64_t) DIRECT_PAGE_SIZE - 1);
+  buffered = end - buff_offset;
+  dirty = false;
+  prealloc.reset(end);
+
+  /* the partial last page is rewritten as a whole by the next flush */
+  if (buffered > 0)
+  {
+    ssize_t n;
+    do
+      n = pread(fd, buff, DIRECT_PAGE_SIZE, buff_offset);
+    while (n == -1 && errno == EINTR);
+
+    if (n != (ssize_t) buffered)
+    {
+      ::close(fd);
+      fd = -1;
+      throw runtime_error("Could not read file: " + filename);
+    }
+  }
+}
+
+void CryptoLog::DirectSink::close()
+{
+  if (fd == -1)
+    return;
+
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+    ::close(fd);
+    fd = -1;
+    throw;
+  }
+
+  ::close(fd);
+  fd = -1;
+}
+
+void CryptoLog::DirectSink::set_direct(bool on)
+{
+  if (!direct)
+    return;
+
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, on ? (flags | O_DIRECT) : (flags & ~O_DIRECT));
+}
+
+void CryptoLog::DirectSink::write_fully(const unsigned char *data, size_t size, uint64_t offset)
+{
+  prealloc.reserve(fd, offset + size);
+
+  while (size > 0)
+  {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw runtime_error("Could not write file: " + filename);
+
+    data += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+/* writes the first size bytes of the buffer, whole pages, and drops them */
+void CryptoLog::DirectSink::write_pages(size_t size)
+{
+  write_fully(buff, size, buff_offset);
+
+  memmove(buff, buff + size, buffered - size);
+  buffered -= size;
+  buff_offset += size;
+}
+
+void CryptoLog::DirectSink::append(const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*) data;
+
+  while (size > 0)
+  {
+    size_t n = SINK_BUFFER_SIZE - buffered;
+    if (n > size)
+      n = size;
+
+    memcpy(buff + buffered, p, n);
+    buffered += n;
+    end += n;
+    p += n;
+    size -= n;
+    dirty = true;
+
+    if (buffered == SINK_BUFFER_SIZE)
+      write_pages(SINK_BUFFER_SIZE);
+  }
+}
+
+void CryptoLog::DirectSink::flush()
+{
+  if (!dirty)
+    return;
+
+  size_t pages = buffered & ~((size_t) DIRECT_PAGE_SIZE - 1);
+  if (pages > 0)
+    write_pages(pages);
+
+  if (buffered > 0)
+  {
+    set_direct(false);
+    try
+    {
+      write_fully(buff, buffered, buff_offset);
+    }
+    catch (...)
+    {
+      set_direct(true);
+      throw;
+    }
+    set_direct(true);
+  }
+
+  dirty = false;
+}
+
+void CryptoLog::DirectSink::sync()
+{
+  flush();
+  if (sync_fd(fd) != 0)
+    throw runtime_error("Could not sync file: " + filename);
+}
+
+void CryptoLog::DirectSink::write_at(const void *data, size_t size, uint64_t offset)
+{
+  const unsigned char *p = (const unsigned char*) data;
+
+  /* keep the staged tail page in step, the next flush writes it again */
+  if (offset + size > buff_offset)
+  {
+    uint64_t from = (offset > buff_offset) ? offset : buff_offset;
+    memcpy(buff + (from - buff_offset), p + (from - offset), offset + size - from);
+  }
+
+  set_direct(false);
+  try
+  {
+    write_fully(p, size, offset);
+  }
+  catch (...)
+  {
+    set_direct(true);
+    throw;
+  }
+  set_direct(true);
+}
+
+void CryptoLog::DirectSink::read_at(void *data, size_t size, uint64_t offset)
+{
+  unsigned char *p = (unsigned char*) data;
+
+  /* the staged bytes come from memory, the rest from the file */
+  if (offset + size > buff_offset)
+  {
+    uint64_t from = (offset > buff_offset) ? offset : buff_offset;
+    memcpy(p + (from - offset), buff + (from - buff_offset), offset + size - from);
+    size = from - offset;
+  }
+
+  set_direct(false);
+  while (size > 0)
+  {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      set_direct(true);
+      throw runtime_error("Could not read file: " + filename);
+    }
+
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  set_direct(true);
+}
+#endif
+
+CryptoLog::Sink* CryptoLog::direct_sink()
+{
+#if CRYPTOLOG_HAVE_DIRECT
+  return new DirectSink;
+#else
+  return default_sink();
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <stdint.h>
+
+using namespace std;
+
+/* set in the flags of every record; the other bits are reserved */
+#define FRAME_RECORD 0x01
+/* the flags this version reads; records with others set are skipped */
+#define FRAME_FLAGS  FRAME_RECORD
+/* the longest record header: the flags and a 64 bit varint */
+#define FRAME_HEADER_MAX 11
+
+/*
+ * The framed format (see Log::set_framing()). Every message is a record
+ * inside the plaintext:
+ *
+ *   flags    one byte, never zero
+ *   length   the length of the payload, a varint: 7 bits a byte, least
+ *            significant first, the high bit set on all but the last
+ *   payload  the message, any bytes
+ *
+ * Records follow each other directly; the zeros CBC pads the messages
+ * with can only come where a record would start and are skipped there,
+ * since the flags of a record are never zero. Payloads may then hold
+ * zeros and be read back record by record.
+ */
+namespace CryptoLog {
+  /* writes the header of a record of size bytes, returns its length */
+  size_t frame_header(unsigned char header[FRAME_HEADER_MAX], uint64_t size);
+}
+
+size_t CryptoLog::frame_header(unsigned char header[FRAME_HEADER_MAX], uint64_t size)
+{
+  size_t length = 0;
+
+  header[length++] = FRAME_RECORD;
+  while (size >= 0x80)
+  {
+    header[length++] = (unsigned char) (size | 0x80);
+    size >>= 7;
+  }
+  header[length++] = (unsigned char) size;
+
+  return length;
+}
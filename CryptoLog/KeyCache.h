@@ -0,0 +1,153 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include "Random.h"
+#include "polarssl/blowfish.h"
+
+using namespace std;
+
+/* expanded schedules kept before the cache starts evicting */
+#define KEY_CACHE_MAX_ENTRIES 64
+
+namespace CryptoLog {
+  uint64_t siphash24(const unsigned char k[16], const unsigned char *data, size_t len);
+
+  /*
+   * Process-wide cache of expanded Blowfish key schedules. Entries are
+   * looked up by a 128-bit keyed hash (two SipHash-2-4 runs under random
+   * per-process keys) of the raw key and its length, so raw keys are
+   * never stored.
+   */
+  class BlowfishKeyCache {
+    public:
+      static BlowfishKeyCache& instance();
+      shared_ptr<const blowfish_context> get(const unsigned char key[], unsigned int keylen);
+    private:
+      struct KeyId {
+        uint64_t h[2];
+        bool operator==(const KeyId &other) const
+        {
+          return h[0] == other.h[0] && h[1] == other.h[1];
+        }
+      };
+      struct KeyIdHash {
+        size_t operator()(const KeyId &id) const { return id.h[0]; }
+      };
+      BlowfishKeyCache();
+      mutex m;
+      unsigned char hash_keys[2][16];
+      unordered_map<KeyId, shared_ptr<const blowfish_context>, KeyIdHash> entries;
+  };
+}
+
+#define SIPROUND                                                  \
+  do {                                                            \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0;             \
+    v0 = (v0 << 32) | (v0 >> 32);                                 \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2;             \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0;             \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2;             \
+    v2 = (v2 << 32) | (v2 >> 32);                                 \
+  } while (0)
+
+uint64_t CryptoLog::siphash24(const unsigned char k[16], const unsigned char *data, size_t len)
+{
+  uint64_t k0 = 0, k1 = 0, m, b = (uint64_t) len << 56;
+  size_t i, tail = len & 7;
+
+  for (i = 0; i < 8; i++)
+  {
+    k0 |= (uint64_t) k[i] << (8 * i);
+    k1 |= (uint64_t) k[i + 8] << (8 * i);
+  }
+
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+  for (; len >= 8; len -= 8, data += 8)
+  {
+    m = 0;
+    for (i = 0; i < 8; i++)
+      m |= (uint64_t) data[i] << (8 * i);
+
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  for (i = 0; i < tail; i++)
+    b |= (uint64_t) data[i] << (8 * i);
+
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
+CryptoLog::BlowfishKeyCache& CryptoLog::BlowfishKeyCache::instance()
+{
+  static BlowfishKeyCache cache;
+  return cache;
+}
+
+CryptoLog::BlowfishKeyCache::BlowfishKeyCache()
+{
+  random_data(&hash_keys[0][0], sizeof(hash_keys));
+}
+
+shared_ptr<const blowfish_context>
+CryptoLog::BlowfishKeyCache::get(const unsigned char key[], unsigned int keylen)
+{
+  /* keylen is in bits, as for blowfish_setkey */
+  unsigned char input[BLOWFISH_MAX_KEY / 8 + sizeof(keylen)];
+  size_t input_len = (keylen + 7) / 8;
+  KeyId id;
+
+  if (keylen < BLOWFISH_MIN_KEY || keylen > BLOWFISH_MAX_KEY)
+    throw runtime_error("Invalid key length");
+
+  memcpy(input, key, input_len);
+  memcpy(input + input_len, &keylen, sizeof(keylen));
+  input_len += sizeof(keylen);
+
+  id.h[0] = siphash24(hash_keys[0], input, input_len);
+  id.h[1] = siphash24(hash_keys[1], input, input_len);
+  memset(input, 0, sizeof(input));
+
+  lock_guard<mutex> lock(m);
+
+  auto it = entries.find(id);
+  if (it != entries.end())
+    return it->second;
+
+  shared_ptr<blowfish_context> ctx(new blowfish_context, [](blowfish_context *ctx) {
+    blowfish_free(ctx);
+    delete ctx;
+  });
+  blowfish_init(ctx.get());
+  if (blowfish_setkey(ctx.get(), key, keylen) != 0)
+    throw runtime_error("Invalid key length");
+
+  if (entries.size() >= KEY_CACHE_MAX_ENTRIES)
+    entries.erase(entries.begin());
+  entries[id] = ctx;
+
+  return ctx;
+}
@@ -0,0 +1,1022 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "CryptoLog.h"
+#include "Cipher.h"
+#include "Frame.h"
+#include "Mode.h"
+#include "Queue.h"
+#include "Reader.h"
+#include "Sink.h"
+
+using namespace std;
+
+/*
+ * A log encrypted with Cipher (see Cipher.h) in Mode (see Mode.h), e.g.
+ * Log<Blowfish, CBC>. Both are fixed at compile time, so the calls into
+ * the cipher and the mode are direct and the block-sized buffers have
+ * their size known; the class is final so calls through it are not
+ * virtual either.
+ */
+namespace CryptoLog {
+  /*
+   * When write() hands messages to the cipher and the file. While batching,
+   * messages are collected and encrypted and written as one buffer once
+   * they reach max_bytes or max_records, once the oldest of them is
+   * max_delay_ms old (a background thread waits for that), or on flush(),
+   * close() and get_plain_text(). A zero disables that trigger; the default
+   * policy, all zeros, writes every message through.
+   */
+  struct BatchPolicy {
+    BatchPolicy(size_t max_bytes = 0, size_t max_records = 0, unsigned int max_delay_ms = 0)
+      : max_bytes(max_bytes), max_records(max_records), max_delay_ms(max_delay_ms) {}
+    bool enabled() const { return max_bytes != 0 || max_records != 0 || max_delay_ms != 0; }
+
+    size_t max_bytes;
+    size_t max_records;
+    unsigned int max_delay_ms;
+  };
+
+  /*
+   * When the log asks its sink to put what was written on stable storage:
+   * never (the kernel decides), once interval_ms passed since the last
+   * sync, after every batch handed to the sink, or before every write()
+   * returns. Every level but NONE also syncs on close(). Concurrent sync()
+   * calls share one fdatasync.
+   *
+   * The periodic sync does not wait for the next write: a background
+   * thread (the async writer, or the batch timer) runs it, so a message
+   * handed to the sink is on stable storage about interval_ms later at
+   * most, plus the time the sync takes. A batched message is handed to
+   * the sink when its batch is written (see BatchPolicy).
+   */
+  enum Durability {
+    DURABILITY_NONE,
+    DURABILITY_PERIODIC,
+    DURABILITY_PER_BATCH,
+    DURABILITY_PER_WRITE
+  };
+
+/* the most the background writer collects from the queue into one write */
+#define ASYNC_MAX_BATCH (256*1024)
+
+  template <class Cipher, template <class> class Mode>
+  class Log final : public CryptoLog {
+    public:
+      typedef ::CryptoLog::Reader<Cipher, Mode> Reader;
+
+      Log();
+      Log(const string &filename);
+      Log(const string &filename, const unsigned char key[], unsigned int keylen);
+      Log(const string &filename, const unsigned char key[]);
+      Log(const string &filename, const vector<unsigned char> &key);
+      ~Log();
+      virtual void open(const string &filename);
+      virtual void close();
+      void set_key(const unsigned char key[], unsigned int keylen);
+      void set_key(const unsigned char key[]);
+      void set_key(const vector<unsigned char> &key);
+      void set_threads(unsigned int threads);
+      void set_batching(const BatchPolicy &policy);
+      void set_async(size_t capacity);
+      void set_sink(Sink *sink);
+      void set_preallocation(uint64_t chunk);
+      void set_durability(Durability level, unsigned int interval_ms = 0);
+      Durability get_durability() const { return durability; }
+      void set_framing(bool framed);
+      bool get_framing() const { return framed; }
+      virtual void write(const string &str);
+      virtual void write(const char *data, size_t size);
+      void write(const char *str);
+#if __cplusplus >= 201703L
+      void write(string_view str);
+#endif
+      virtual void writev(const struct iovec *iov, int iovcnt);
+      void write_framed(const char *data, size_t size);
+      virtual void flush();
+      virtual void sync();
+      void sync(unsigned long long seq);
+      unsigned long long sequence() const { return accepted.load(); }
+      virtual string read();
+      virtual string get_plain_text();
+      vector<string> get_records();
+      Reader reader();
+      virtual Log& operator<<(const string &str);
+      Log& operator<<(const char *str);
+#if __cplusplus >= 201703L
+      Log& operator<<(string_view str);
+#endif
+    private:
+      typename Cipher::context ctx;
+      Mode<Cipher> mode;
+      string filename;
+      void init_state();
+      void write_message(const struct iovec *iov, int iovcnt);
+      unique_ptr<Sink> sink;
+      uint64_t prealloc_chunk = 0;
+      bool framed = false;
+      unsigned int threads = 0;
+      BatchPolicy batch;
+      /* the batch, guarded by io_mutex */
+      void write_pending();
+      string pending;
+      size_t pending_records = 0;
+      chrono::steady_clock::time_point pending_since;
+      /* the thread that flushes a batch max_delay_ms old (see set_batching())
+         and syncs periodically (see set_durability()) */
+      void start_timer();
+      void stop_timer();
+      void timer_loop();
+      thread timer;
+      condition_variable timer_cv;
+      bool timer_stop = false;
+
+      /* durability, see set_durability() and sync() */
+      void after_batch(unsigned long long upto);
+      void synced(unsigned long long upto);
+      bool sync_due();
+      Durability durability = DURABILITY_NONE;
+      unsigned int sync_interval_ms = 0;
+      /* the number of messages written so far, the sequence of the last one */
+      atomic<unsigned long long> accepted{0};
+      mutex sync_mutex;
+      condition_variable sync_cv;
+      bool syncing = false;
+      unsigned long long durable = 0;
+      chrono::steady_clock::time_point last_sync;
+
+      /* the background writer, see set_async() */
+      void start_writer();
+      void stop_writer();
+      void writer_loop();
+      unsigned long long enqueue(string &msg);
+      size_t async_capacity = 0;
+      unique_ptr<MPSCQueue<string>> queue;
+      /* the sequence number in front of the first message of the queue */
+      unsigned long long queue_base = 0;
+      thread writer;
+      /* held by the writer while it uses ctx, mode and sink */
+      mutex io_mutex;
+      mutex writer_mutex;
+      condition_variable writer_cv, drained_cv;
+      atomic<bool> writer_sleeping{false};
+      bool writer_stop = false;
+      unsigned long long written = 0;
+      /* a write that failed on the writer or the timer, rethrown by flush() */
+      exception_ptr writer_error;
+  };
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::Log()
+  : sink(default_sink())
+{
+  Cipher::init(&ctx);
+}
+
+/*
+ * Opens the file before a key is set, so only for modes that resume
+ * without one (CBC); the others would resume with an empty key.
+ */
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::Log(const string &filename)
+  : sink(default_sink())
+{
+  static_assert(!Mode<Cipher>::resume_needs_key,
+                "this mode needs the key to open a file, pass it to the constructor");
+  Cipher::init(&ctx);
+  open(filename);
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::Log(const string &filename,
+                                  const unsigned char key[],
+                                  unsigned int keylen)
+  : sink(default_sink())
+{
+  Cipher::init(&ctx);
+  set_key(key, keylen);
+  open(filename);
+}
+
+/* for ciphers with a fixed key length (XTEA), a key of that length */
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::Log(const string &filename,
+                                  const unsigned char key[])
+  : sink(default_sink())
+{
+  static_assert(Cipher::key_bits != 0, "this cipher needs the key length");
+  Cipher::init(&ctx);
+  set_key(key, Cipher::key_bits);
+  open(filename);
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::Log(const string &filename,
+                                  const vector<unsigned char> &key)
+  : sink(default_sink())
+{
+  Cipher::init(&ctx);
+  set_key(key.data(), key.size() * 8);
+  open(filename);
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>::~Log()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+  Cipher::free(&ctx);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::close()
+{
+  if (!sink->is_open())
+    return;
+
+  stop_writer();
+  stop_timer();
+  flush();
+  mode.close(&ctx, *sink);
+
+  if (durability != DURABILITY_NONE)
+  {
+    sink->sync();
+    synced(accepted.load());
+  }
+
+  sink->close();
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::open(const string &filename)
+{
+  close();
+  this->filename = filename;
+  init_state();
+
+  if (async_capacity != 0)
+    start_writer();
+  start_timer();
+}
+
+/*
+ * The sink opens the file once, creating it if needed, and knows its size
+ * from then on; an empty file is a new log and gets its header, anything
+ * else is resumed from the state the mode reads back from it.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::init_state()
+{
+  sink->open(filename);
+
+  uint64_t size = sink->size();
+  if (size == 0)
+    mode.create(&ctx, *sink);
+  else if (size < Mode<Cipher>::header_size)
+  {
+    sink->close();
+    throw runtime_error("File seems corrupted: " + filename);
+  }
+  else
+    mode.resume(&ctx, *sink);
+}
+
+/*
+ * Takes ownership of sink (see Sink.h); an open log is closed and
+ * reopened on it.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_sink(Sink *sink)
+{
+  bool reopen = this->sink->is_open();
+
+  close();
+  this->sink.reset(sink);
+  this->sink->set_preallocation(prealloc_chunk);
+
+  if (reopen)
+    open(filename);
+}
+
+/*
+ * Makes the sink reserve the file chunk bytes at a time ahead of what is
+ * written (see Sink::set_preallocation()), e.g. 64 MiB for a log that
+ * keeps growing; 0, the default, turns it off. The file size, and so what
+ * a reopened log resumes from, is still only what was written.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_preallocation(uint64_t chunk)
+{
+  lock_guard<mutex> lock(io_mutex);
+  prealloc_chunk = chunk;
+  sink->set_preallocation(chunk);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_key(const unsigned char key[], unsigned int keylen)
+{
+  Cipher::set_key(&ctx, key, keylen);
+}
+
+/* for ciphers with a fixed key length (XTEA), a key of that length */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_key(const unsigned char key[])
+{
+  static_assert(Cipher::key_bits != 0, "this cipher needs the key length");
+  set_key(key, Cipher::key_bits);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_key(const vector<unsigned char> &key)
+{
+  set_key(key.data(), key.size() * 8);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_threads(unsigned int threads)
+{
+  this->threads = threads;
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_batching(const BatchPolicy &policy)
+{
+  stop_timer();
+  flush();
+  batch = policy;
+  start_timer();
+}
+
+/*
+ * With a non-zero capacity, write() only queues the message and a
+ * background thread encrypts and appends it; everything queued while the
+ * thread was busy goes out as one buffer. write() may then be called from
+ * several threads at once, the other calls still need the caller to stop
+ * writing. A full queue makes write() wait for room. 0 turns it off.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_async(size_t capacity)
+{
+  stop_writer();
+  stop_timer();
+  flush();
+
+  async_capacity = capacity;
+  if (async_capacity != 0 && sink->is_open())
+    start_writer();
+  start_timer();
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::start_writer()
+{
+  queue.reset(new MPSCQueue<string>(async_capacity));
+  writer_sleeping.store(false);
+  writer_stop = false;
+  written = accepted.load();
+  queue_base = written;
+
+  writer = thread(&Log::writer_loop, this);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::stop_writer()
+{
+  if (!writer.joinable())
+    return;
+
+  {
+    lock_guard<mutex> lock(writer_mutex);
+    writer_stop = true;
+  }
+  writer_cv.notify_one();
+
+  writer.join();
+  queue.reset();
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::writer_loop()
+{
+  string msg, buff;
+  unsigned long long popped;
+
+  {
+    lock_guard<mutex> lock(writer_mutex);
+    popped = written;
+  }
+
+  for (;;)
+  {
+    unsigned long long n = 0;
+    while (buff.size() < ASYNC_MAX_BATCH && queue->pop(msg))
+    {
+      buff += msg;
+      n++;
+    }
+
+    if (n != 0)
+    {
+      exception_ptr error;
+      try
+      {
+        lock_guard<mutex> lock(io_mutex);
+        struct iovec iov = { (void*) buff.data(), buff.size() };
+        mode.write(&ctx, *sink, &iov, 1);
+        sink->flush();
+        after_batch(popped + n);
+      }
+      catch (...)
+      {
+        error = current_exception();
+      }
+      buff.clear();
+      popped += n;
+
+      {
+        lock_guard<mutex> lock(writer_mutex);
+        written = popped;
+        if (error && !writer_error)
+          writer_error = error;
+      }
+      drained_cv.notify_all();
+      continue;
+    }
+
+    /* an idle log still gets its periodic sync */
+    if (durability == DURABILITY_PERIODIC && sync_due())
+    {
+      try
+      {
+        lock_guard<mutex> lock(io_mutex);
+        sink->sync();
+        synced(popped);
+      }
+      catch (...)
+      {
+        lock_guard<mutex> lock(writer_mutex);
+        if (!writer_error)
+          writer_error = current_exception();
+      }
+    }
+
+    /*
+     * Announce the sleep before counting the queued messages once more;
+     * a producer counts its message (see enqueue()) before it looks at
+     * writer_sleeping, and both are sequentially consistent, so one of
+     * the two sees the other. The timeout is only a safety net.
+     */
+    unique_lock<mutex> lock(writer_mutex);
+    writer_sleeping.store(true);
+
+    if (accepted.load() == popped)
+    {
+      if (writer_stop)
+        break;
+
+      unsigned int timeout = 100;
+      if (durability == DURABILITY_PERIODIC && sync_interval_ms != 0 && sync_interval_ms < timeout)
+        timeout = sync_interval_ms;
+      writer_cv.wait_for(lock, chrono::milliseconds(timeout));
+    }
+
+    writer_sleeping.store(false);
+  }
+}
+
+/*
+ * The sequence number of a queued message is its position in the queue,
+ * which is the order the writer pops, writes and counts the messages in.
+ * accepted is raised to it, not incremented: a producer that claimed an
+ * earlier position may count itself later, and a flush() or sync() that
+ * waits for accepted must not be satisfied by that message instead of
+ * the caller's own. Returns the sequence number.
+ */
+template <class Cipher, template <class> class Mode>
+unsigned long long CryptoLog::Log<Cipher, Mode>::enqueue(string &msg)
+{
+  size_t pos;
+  while (!queue->push(msg, pos))
+  {
+    writer_cv.notify_one();
+    this_thread::yield();
+  }
+
+  unsigned long long seq = queue_base + pos + 1;
+  unsigned long long last = accepted.load();
+  while (last < seq && !accepted.compare_exchange_weak(last, seq))
+    ;
+
+  if (writer_sleeping.load())
+  {
+    lock_guard<mutex> lock(writer_mutex);
+    writer_cv.notify_one();
+  }
+
+  return seq;
+}
+
+/*
+ * Batches are only written, and the sink only synced, by the writing
+ * thread otherwise, so a batch waiting for max_delay_ms and a periodic
+ * sync need a thread of their own; it runs while the log is open with
+ * either and is not asynchronous (the background writer does both).
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::start_timer()
+{
+  bool periodic = durability == DURABILITY_PERIODIC && sync_interval_ms != 0;
+  if ((batch.max_delay_ms == 0 && !periodic) || async_capacity != 0 || !sink->is_open())
+    return;
+
+  timer_stop = false;
+  timer = thread(&Log::timer_loop, this);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::stop_timer()
+{
+  if (!timer.joinable())
+    return;
+
+  {
+    lock_guard<mutex> lock(io_mutex);
+    timer_stop = true;
+  }
+  timer_cv.notify_one();
+
+  timer.join();
+}
+
+/*
+ * Sleeps until the oldest message of the batch is max_delay_ms old, or
+ * until the periodic sync is due, and does what is due unless a write or
+ * flush() did meanwhile. A write that starts a batch wakes it up; with
+ * DURABILITY_PERIODIC it also looks every interval_ms for messages the
+ * writes handed to the sink since the last sync.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::timer_loop()
+{
+  unique_lock<mutex> lock(io_mutex);
+  bool periodic = durability == DURABILITY_PERIODIC && sync_interval_ms != 0;
+  chrono::milliseconds interval(sync_interval_ms);
+
+  while (!timer_stop)
+  {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    chrono::steady_clock::time_point wake = chrono::steady_clock::time_point::max();
+
+    try
+    {
+      if (pending_records != 0 && batch.max_delay_ms != 0)
+      {
+        chrono::steady_clock::time_point due = pending_since + chrono::milliseconds(batch.max_delay_ms);
+        if (now >= due)
+        {
+          write_pending();
+          sink->flush();
+        }
+        else
+          wake = due;
+      }
+
+      if (periodic)
+      {
+        if (sync_due())
+        {
+          sink->sync();
+          synced(accepted.load());
+        }
+
+        lock_guard<mutex> sync_lock(sync_mutex);
+        chrono::steady_clock::time_point due = last_sync + interval;
+        wake = min(wake, due > now ? due : now + interval);
+      }
+    }
+    catch (...)
+    {
+      lock_guard<mutex> error_lock(writer_mutex);
+      if (!writer_error)
+        writer_error = current_exception();
+      if (periodic)
+        wake = now + interval;
+    }
+
+    if (wake == chrono::steady_clock::time_point::max())
+      timer_cv.wait(lock);
+    else
+      timer_cv.wait_until(lock, wake);
+  }
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write(const string &str)
+{
+  write(str.data(), str.size());
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write(const char *str)
+{
+  write(str, strlen(str));
+}
+
+#if __cplusplus >= 201703L
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write(string_view str)
+{
+  write(str.data(), str.size());
+}
+#endif
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write(const char *data, size_t size)
+{
+  struct iovec iov = { (void*) data, size };
+  writev(&iov, 1);
+}
+
+/* the record header, if framed, goes in front of the message as one more buffer */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::writev(const struct iovec *iov, int iovcnt)
+{
+  if (!framed)
+  {
+    write_message(iov, iovcnt);
+    return;
+  }
+
+  unsigned char header[FRAME_HEADER_MAX];
+  struct iovec local[8];
+  vector<struct iovec> heap;
+  struct iovec *record = local;
+
+  if (iovcnt + 1 > 8)
+  {
+    heap.resize(iovcnt + 1);
+    record = heap.data();
+  }
+
+  record[0].iov_base = header;
+  record[0].iov_len = frame_header(header, iov_size(iov, iovcnt));
+  memcpy(record + 1, iov, iovcnt * sizeof(struct iovec));
+
+  write_message(record, iovcnt + 1);
+}
+
+/*
+ * Writes records framed by the caller as they are, e.g. a front-end's
+ * batch of them (see Concurrent.h).
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write_framed(const char *data, size_t size)
+{
+  struct iovec iov = { (void*) data, size };
+  write_message(&iov, 1);
+}
+
+/*
+ * Written through, the message is encrypted straight from the caller's
+ * buffers (CBC gathers it into its scratch buffer to pad it); batched or
+ * queued, it is copied once.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write_message(const struct iovec *iov, int iovcnt)
+{
+  if (queue)
+  {
+    string msg;
+    msg.reserve(iov_size(iov, iovcnt));
+    for (int i = 0; i < iovcnt; i++)
+      msg.append((const char*) iov[i].iov_base, iov[i].iov_len);
+
+    unsigned long long seq = enqueue(msg);
+
+    if (durability == DURABILITY_PER_WRITE)
+      sync(seq);
+    return;
+  }
+
+  if (!batch.enabled())
+  {
+    /* the timer may be syncing the sink */
+    lock_guard<mutex> lock(io_mutex);
+    mode.write(&ctx, *sink, iov, iovcnt);
+    after_batch(accepted.fetch_add(1) + 1);
+    return;
+  }
+
+  unsigned long long seq;
+  bool full;
+  {
+    lock_guard<mutex> lock(io_mutex);
+    if (pending_records == 0 && batch.max_delay_ms != 0)
+    {
+      pending_since = chrono::steady_clock::now();
+      timer_cv.notify_one();
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+      pending.append((const char*) iov[i].iov_base, iov[i].iov_len);
+    pending_records++;
+    seq = accepted.fetch_add(1) + 1;
+
+    full = (batch.max_bytes != 0 && pending.size() >= batch.max_bytes) ||
+           (batch.max_records != 0 && pending_records >= batch.max_records);
+  }
+
+  if (full)
+    flush();
+
+  if (durability == DURABILITY_PER_WRITE)
+    sync(seq);
+}
+
+/*
+ * The modes append messages back to back (CBC strips the zero padding
+ * when it decrypts), so a batch is simply the messages concatenated.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::flush()
+{
+  if (!sink->is_open())
+    return;
+
+  if (queue)
+  {
+    /* wait for the writer to append what was queued so far */
+    unsigned long long target = accepted.load();
+    unique_lock<mutex> lock(writer_mutex);
+    writer_cv.notify_one();
+    drained_cv.wait(lock, [this, target] { return written >= target; });
+
+    if (writer_error)
+    {
+      exception_ptr error = writer_error;
+      writer_error = nullptr;
+      rethrow_exception(error);
+    }
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(io_mutex);
+    write_pending();
+    sink->flush();
+  }
+
+  /* a batch the timer failed to write */
+  exception_ptr error;
+  {
+    lock_guard<mutex> lock(writer_mutex);
+    error = writer_error;
+    writer_error = nullptr;
+  }
+  if (error)
+    rethrow_exception(error);
+}
+
+/*
+ * Called with io_mutex held. A batch the sink fails to take is dropped,
+ * as a message written through would be, rather than tried again.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::write_pending()
+{
+  if (pending_records == 0)
+    return;
+
+  struct iovec iov = { (void*) pending.data(), pending.size() };
+  try
+  {
+    mode.write(&ctx, *sink, &iov, 1);
+  }
+  catch (...)
+  {
+    pending.clear();
+    pending_records = 0;
+    throw;
+  }
+  pending.clear();
+  pending_records = 0;
+
+  after_batch(accepted.load());
+}
+
+/*
+ * Frames every message written from now on as a record (see Frame.h), so
+ * reading returns the messages one by one, whatever bytes they hold. The
+ * format is not marked in the file: like the key, framing has to be set
+ * the same way every time the log is opened, before it is written.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_framing(bool framed)
+{
+  this->framed = framed;
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::set_durability(Durability level, unsigned int interval_ms)
+{
+  /* the background threads read the policy, they are restarted around the change */
+  stop_writer();
+  stop_timer();
+
+  durability = level;
+  sync_interval_ms = interval_ms;
+  {
+    lock_guard<mutex> lock(sync_mutex);
+    last_sync = chrono::steady_clock::now();
+  }
+
+  if (async_capacity != 0 && sink->is_open())
+    start_writer();
+  start_timer();
+}
+
+template <class Cipher, template <class> class Mode>
+bool CryptoLog::Log<Cipher, Mode>::sync_due()
+{
+  lock_guard<mutex> lock(sync_mutex);
+  return durable < accepted.load() &&
+         chrono::steady_clock::now() - last_sync >= chrono::milliseconds(sync_interval_ms);
+}
+
+/* the messages up to upto were just handed to the sink */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::after_batch(unsigned long long upto)
+{
+  if (durability == DURABILITY_PER_BATCH || durability == DURABILITY_PER_WRITE ||
+      (durability == DURABILITY_PERIODIC && sync_due()))
+  {
+    sink->sync();
+    synced(upto);
+  }
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::synced(unsigned long long upto)
+{
+  {
+    lock_guard<mutex> lock(sync_mutex);
+    if (durable < upto)
+      durable = upto;
+    last_sync = chrono::steady_clock::now();
+  }
+  sync_cv.notify_all();
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::sync()
+{
+  sync(accepted.load());
+}
+
+/*
+ * Returns once the message with sequence number seq (see sequence()) and
+ * all before it are on stable storage. One caller at a time flushes and
+ * syncs everything written so far; the callers that come meanwhile wait
+ * for it and are covered by it or by the next one (group commit). With
+ * set_async() any thread may call it, otherwise only the writing one.
+ */
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Log<Cipher, Mode>::sync(unsigned long long seq)
+{
+  unique_lock<mutex> lock(sync_mutex);
+
+  if (seq > accepted.load())
+    seq = accepted.load();
+
+  while (durable < seq)
+  {
+    if (syncing)
+    {
+      sync_cv.wait(lock);
+      continue;
+    }
+
+    syncing = true;
+    lock.unlock();
+
+    unsigned long long target = accepted.load();
+    exception_ptr error;
+    try
+    {
+      flush();
+
+      /* the writer or the batch flushed above may have synced it already */
+      bool done;
+      {
+        lock_guard<mutex> sync_lock(sync_mutex);
+        done = durable >= target;
+      }
+
+      lock_guard<mutex> io_lock(io_mutex);
+      if (!done && sink->is_open())
+        sink->sync();
+    }
+    catch (...)
+    {
+      error = current_exception();
+    }
+
+    lock.lock();
+    syncing = false;
+    if (!error && durable < target)
+      durable = target;
+    sync_cv.notify_all();
+
+    if (error)
+      rethrow_exception(error);
+  }
+}
+
+template <class Cipher, template <class> class Mode>
+string CryptoLog::Log<Cipher, Mode>::get_plain_text()
+{
+  Reader r = reader();
+  string plaintext;
+  const char *data;
+  size_t size;
+
+  plaintext.reserve(r.left());
+  while (r.next(data, size))
+    plaintext.append(data, size);
+
+  return plaintext;
+}
+
+/* the messages of a framed log, see set_framing() */
+template <class Cipher, template <class> class Mode>
+vector<string> CryptoLog::Log<Cipher, Mode>::get_records()
+{
+  if (!framed)
+    throw runtime_error("Log is not framed: " + filename);
+
+  Reader r = reader();
+  vector<string> records;
+  const char *data;
+  size_t size;
+
+  while (r.next(data, size))
+    records.emplace_back(data, size);
+
+  return records;
+}
+
+/* a streaming reader of everything written so far, see Reader.h */
+template <class Cipher, template <class> class Mode>
+typename CryptoLog::Log<Cipher, Mode>::Reader CryptoLog::Log<Cipher, Mode>::reader()
+{
+  flush();
+  return Reader(ctx, *sink, io_mutex, threads, framed);
+}
+
+template <class Cipher, template <class> class Mode>
+string CryptoLog::Log<Cipher, Mode>::read()
+{
+  return get_plain_text();
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>& CryptoLog::Log<Cipher, Mode>::operator<<(const string &str)
+{
+  write(str);
+  return *this;
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>& CryptoLog::Log<Cipher, Mode>::operator<<(const char *str)
+{
+  write(str);
+  return *this;
+}
+
+#if __cplusplus >= 201703L
+template <class Cipher, template <class> class Mode>
+CryptoLog::Log<Cipher, Mode>& CryptoLog::Log<Cipher, Mode>::operator<<(string_view str)
+{
+  write(str);
+  return *this;
+}
+#endif
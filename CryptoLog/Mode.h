@@ -0,0 +1,415 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Compact.h"
+#include "CryptoLog.h"
+#include "Parallel.h"
+#include "Random.h"
+#include "Sink.h"
+
+using namespace std;
+
+/*
+ * Mode policies for CryptoLog::Log. A mode owns the chaining state of an
+ * open log and knows the layout of the file header in front of the
+ * ciphertext:
+ *
+ *   create()   writes the header of a new file
+ *   resume()   restores the state from an existing file
+ *   close()    writes the state to the header before the file is closed,
+ *              where versions that do not derive it on resume() read it
+ *   write()    encrypts and appends one message, gathered from iovcnt buffers
+ *   start()    sets a Cursor to the beginning of the ciphertext
+ *   decrypt()  decrypts the next piece of the ciphertext at the cursor
+ *   text()     the text of a decrypted piece in a log without framing
+ *              (see Frame.h): moves it to the front and returns its length
+ *   ended()    whether text() found the end of the text, so the pieces
+ *              after it need not be decrypted
+ *
+ * The ciphertext is decrypted piece by piece (see Reader.h); every piece
+ * but the last is a multiple of the block size. resume_needs_key says
+ * whether resume() encrypts with the key, i.e. the key has to be set
+ * before an existing file is opened.
+ */
+namespace CryptoLog {
+  /*
+   * Scratch space owned by a log and reused by every write(), so the
+   * write path does not allocate once the buffer has grown to the size
+   * of the longest message.
+   */
+  class Scratch {
+    public:
+      unsigned char* get(size_t size)
+      {
+        if (buff.size() < size)
+          buff.resize(size);
+        return buff.data();
+      }
+    private:
+      vector<unsigned char> buff;
+  };
+
+  template <class Cipher>
+  class CBC {
+    public:
+      /* the first IV */
+      static const size_t header_size = Cipher::block_size;
+      static const bool resume_needs_key = false;
+      void create(typename Cipher::context *ctx, Sink &sink);
+      void resume(typename Cipher::context *ctx, Sink &sink);
+      void close(typename Cipher::context *ctx, Sink &sink);
+      void write(typename Cipher::context *ctx, Sink &sink, const struct iovec *iov, int iovcnt);
+      /* the IV of the next block */
+      struct Cursor {
+        unsigned char iv[Cipher::block_size];
+      };
+      static void start(const unsigned char header[], Cursor &cursor);
+      static void decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                          const unsigned char *input, size_t size,
+                          unsigned char *output, unsigned int threads);
+      static size_t text(Cursor &cursor, unsigned char *output, size_t size);
+      /* the padding is spread over the text, it has no end */
+      static bool ended(const Cursor &cursor) { return false; }
+    private:
+      unsigned char iv[Cipher::block_size];
+      Scratch scratch;
+  };
+
+  template <class Cipher>
+  class CFB {
+    public:
+      /* the first IV, the encrypted current IV and the offset in it */
+      static const size_t header_size = 2 * Cipher::block_size + sizeof(size_t);
+      static const bool resume_needs_key = true;
+      void create(typename Cipher::context *ctx, Sink &sink);
+      void resume(typename Cipher::context *ctx, Sink &sink);
+      void close(typename Cipher::context *ctx, Sink &sink);
+      void write(typename Cipher::context *ctx, Sink &sink, const struct iovec *iov, int iovcnt);
+      /* the IV of the next block, and whether the text has ended */
+      struct Cursor {
+        unsigned char iv[Cipher::block_size];
+        bool end;
+      };
+      static void start(const unsigned char header[], Cursor &cursor);
+      static void decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                          const unsigned char *input, size_t size,
+                          unsigned char *output, unsigned int threads);
+      static size_t text(Cursor &cursor, unsigned char *output, size_t size);
+      static bool ended(const Cursor &cursor) { return cursor.end; }
+    private:
+      unsigned char iv[Cipher::block_size];
+      size_t iv_off;
+      Scratch scratch;
+  };
+
+  template <class Cipher>
+  class CTR {
+    public:
+      /* the nonce, the current counter, the encrypted stream block and the offset in it */
+      static const size_t header_size = 2 * Cipher::block_size
+                                        + Cipher::block_size / 2
+                                        + sizeof(size_t);
+      static const bool resume_needs_key = true;
+      void create(typename Cipher::context *ctx, Sink &sink);
+      void resume(typename Cipher::context *ctx, Sink &sink);
+      void close(typename Cipher::context *ctx, Sink &sink);
+      void write(typename Cipher::context *ctx, Sink &sink, const struct iovec *iov, int iovcnt);
+      /* the counter of the next block, and whether the text has ended */
+      struct Cursor {
+        unsigned char nonce_counter[Cipher::block_size];
+        bool end;
+      };
+      static void start(const unsigned char header[], Cursor &cursor);
+      static void decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                          const unsigned char *input, size_t size,
+                          unsigned char *output, unsigned int threads);
+      static size_t text(Cursor &cursor, unsigned char *output, size_t size);
+      static bool ended(const Cursor &cursor) { return cursor.end; }
+    private:
+      unsigned char nonce_counter[Cipher::block_size];
+      unsigned char stream_block[Cipher::block_size];
+      size_t nc_off;
+      Scratch scratch;
+  };
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::create(typename Cipher::context *ctx, Sink &sink)
+{
+  random_data(iv, Cipher::block_size);
+
+  sink.append(iv, Cipher::block_size);
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::resume(typename Cipher::context *ctx, Sink &sink)
+{
+  sink.read_at(iv, Cipher::block_size, sink.size() - Cipher::block_size);
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::close(typename Cipher::context *ctx, Sink &sink)
+{
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::write(typename Cipher::context *ctx, Sink &sink,
+                                   const struct iovec *iov, int iovcnt)
+{
+  size_t size = iov_size(iov, iovcnt);
+  /* zero padded to the next block, with at least one zero byte */
+  size_t buff_size = (size / Cipher::block_size + 1) * Cipher::block_size;
+  unsigned char *buff = scratch.get(buff_size);
+
+  iov_gather(buff, iov, iovcnt);
+  memset(buff + size, 0, buff_size - size);
+
+  Cipher::cbc_encrypt(ctx, buff_size, iv, buff, buff);
+
+  sink.append(buff, buff_size);
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::start(const unsigned char header[], Cursor &cursor)
+{
+  memcpy(cursor.iv, header, Cipher::block_size);
+}
+
+template <class Cipher>
+void CryptoLog::CBC<Cipher>::decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                                     const unsigned char *input, size_t size,
+                                     unsigned char *output, unsigned int threads)
+{
+  if (size < Cipher::block_size)
+    return;
+
+  parallel_decrypt<Cipher::block_size>(size, cursor.iv, input, output, threads,
+    [ctx](size_t length, unsigned char iv[], const unsigned char *input, unsigned char *output) {
+      Cipher::cbc_decrypt(ctx, length, iv, input, output);
+    });
+
+  memcpy(cursor.iv, input + size - Cipher::block_size, Cipher::block_size);
+}
+
+/* the zeros the messages were padded with are dropped */
+template <class Cipher>
+size_t CryptoLog::CBC<Cipher>::text(Cursor &cursor, unsigned char *output, size_t size)
+{
+  return drop_zeros(output, size);
+}
+
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::create(typename Cipher::context *ctx, Sink &sink)
+{
+  iv_off = 0;
+  random_data(iv, Cipher::block_size);
+
+  sink.append(iv, Cipher::block_size);
+  sink.append(iv, Cipher::block_size);
+  sink.append(&iv_off, sizeof(size_t));
+}
+
+/*
+ * The state follows from the length of the ciphertext: the IV is its last
+ * whole block, encrypted and overlaid with the bytes of a block cut short.
+ * A log that was not closed, after a crash, so carries on where its data
+ * ends rather than from the state in the header.
+ */
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::resume(typename Cipher::context *ctx, Sink &sink)
+{
+  uint64_t length = sink.size() - header_size;
+  uint64_t whole = length - length % Cipher::block_size;
+  iv_off = (size_t) (length % Cipher::block_size);
+
+  /* the first IV if there is no whole block yet */
+  sink.read_at(iv, Cipher::block_size, whole == 0 ? 0 : header_size + whole - Cipher::block_size);
+
+  if (iv_off != 0)
+  {
+    Cipher::encrypt_block(ctx, iv, iv);
+    sink.read_at(iv, iv_off, sink.size() - iv_off);
+  }
+}
+
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::close(typename Cipher::context *ctx, Sink &sink)
+{
+  random_data(iv, iv_off);
+  Cipher::encrypt_block(ctx, iv, iv);
+
+  unsigned char state[Cipher::block_size + sizeof(size_t)];
+  memcpy(state, iv, Cipher::block_size);
+  memcpy(state + Cipher::block_size, &iv_off, sizeof(size_t));
+
+  sink.write_at(state, sizeof(state), Cipher::block_size);
+}
+
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::write(typename Cipher::context *ctx, Sink &sink,
+                                   const struct iovec *iov, int iovcnt)
+{
+  size_t buff_size = iov_size(iov, iovcnt);
+  unsigned char *out_buff = scratch.get(buff_size), *out = out_buff;
+
+  /* straight from the caller's buffers, the stream carries on across them */
+  for (int i = 0; i < iovcnt; i++)
+  {
+    Cipher::cfb_encrypt(ctx, iov[i].iov_len, &iv_off, iv,
+                        (const unsigned char*) iov[i].iov_base, out);
+    out += iov[i].iov_len;
+  }
+
+  sink.append(out_buff, buff_size);
+}
+
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::start(const unsigned char header[], Cursor &cursor)
+{
+  memcpy(cursor.iv, header, Cipher::block_size);
+  cursor.end = false;
+}
+
+template <class Cipher>
+void CryptoLog::CFB<Cipher>::decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                                     const unsigned char *input, size_t size,
+                                     unsigned char *output, unsigned int threads)
+{
+  parallel_decrypt<Cipher::block_size>(size, cursor.iv, input, output, threads,
+    [ctx](size_t length, unsigned char iv[], const unsigned char *input, unsigned char *output) {
+      size_t iv_off = 0;
+      Cipher::cfb_decrypt(ctx, length, &iv_off, iv, input, output);
+    });
+
+  if (size >= Cipher::block_size)
+    memcpy(cursor.iv, input + size - Cipher::block_size, Cipher::block_size);
+}
+
+/* the text ends at its first zero byte */
+template <class Cipher>
+size_t CryptoLog::CFB<Cipher>::text(Cursor &cursor, unsigned char *output, size_t size)
+{
+  if (cursor.end)
+    return 0;
+
+  const unsigned char *zero = (const unsigned char*) memchr(output, 0x00, size);
+  if (zero == NULL)
+    return size;
+
+  cursor.end = true;
+  return zero - output;
+}
+
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::create(typename Cipher::context *ctx, Sink &sink)
+{
+  nc_off = 0;
+
+  memset(nonce_counter, 0, Cipher::block_size);
+  random_data(nonce_counter, Cipher::block_size / 2);
+
+  sink.append(nonce_counter, Cipher::block_size / 2);
+
+  sink.append(nonce_counter, Cipher::block_size);
+  sink.append(nonce_counter, Cipher::block_size);
+
+  sink.append(&nc_off, sizeof(size_t));
+}
+
+/*
+ * The state follows from the length of the ciphertext, block b being
+ * encrypted with the nonce plus b (see parallel_ctr()), so a log that was
+ * not closed, after a crash, never uses a keystream block twice.
+ */
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::resume(typename Cipher::context *ctx, Sink &sink)
+{
+  uint64_t length = sink.size() - header_size;
+  size_t blocks = (size_t) ((length + Cipher::block_size - 1) / Cipher::block_size);
+  nc_off = (size_t) (length % Cipher::block_size);
+
+  memset(nonce_counter, 0, Cipher::block_size);
+  sink.read_at(nonce_counter, Cipher::block_size / 2, 0);
+
+  /* the rest of the stream block of a block cut short is still to be used */
+  memset(stream_block, 0, Cipher::block_size);
+  if (nc_off != 0)
+  {
+    add_counter<Cipher::block_size>(nonce_counter, blocks - 1, stream_block);
+    Cipher::encrypt_block(ctx, stream_block, stream_block);
+  }
+
+  add_counter<Cipher::block_size>(nonce_counter, blocks, nonce_counter);
+}
+
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::close(typename Cipher::context *ctx, Sink &sink)
+{
+  Cipher::encrypt_block(ctx, stream_block, stream_block);
+
+  unsigned char state[2 * Cipher::block_size + sizeof(size_t)];
+  memcpy(state, nonce_counter, Cipher::block_size);
+  memcpy(state + Cipher::block_size, stream_block, Cipher::block_size);
+  memcpy(state + 2 * Cipher::block_size, &nc_off, sizeof(size_t));
+
+  sink.write_at(state, sizeof(state), Cipher::block_size / 2);
+}
+
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::write(typename Cipher::context *ctx, Sink &sink,
+                                   const struct iovec *iov, int iovcnt)
+{
+  size_t buff_size = iov_size(iov, iovcnt);
+  unsigned char *out_buff = scratch.get(buff_size), *out = out_buff;
+
+  for (int i = 0; i < iovcnt; i++)
+  {
+    Cipher::ctr_crypt(ctx, iov[i].iov_len, &nc_off, nonce_counter, stream_block,
+                      (const unsigned char*) iov[i].iov_base, out);
+    out += iov[i].iov_len;
+  }
+
+  sink.append(out_buff, buff_size);
+}
+
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::start(const unsigned char header[], Cursor &cursor)
+{
+  memset(cursor.nonce_counter, 0, Cipher::block_size);
+  memcpy(cursor.nonce_counter, header, Cipher::block_size / 2);
+  cursor.end = false;
+}
+
+template <class Cipher>
+void CryptoLog::CTR<Cipher>::decrypt(typename Cipher::context *ctx, Cursor &cursor,
+                                     const unsigned char *input, size_t size,
+                                     unsigned char *output, unsigned int threads)
+{
+  parallel_ctr<Cipher::block_size>(size, cursor.nonce_counter, input, output, threads,
+    [ctx](size_t length, unsigned char nonce_counter[], const unsigned char *input, unsigned char *output) {
+      unsigned char stream_block[Cipher::block_size];
+      size_t nc_off = 0;
+      Cipher::ctr_crypt(ctx, length, &nc_off, nonce_counter, stream_block, input, output);
+    });
+
+  add_counter<Cipher::block_size>(cursor.nonce_counter, size / Cipher::block_size,
+                                  cursor.nonce_counter);
+}
+
+/* the text ends at its first zero byte */
+template <class Cipher>
+size_t CryptoLog::CTR<Cipher>::text(Cursor &cursor, unsigned char *output, size_t size)
+{
+  if (cursor.end)
+    return 0;
+
+  const unsigned char *zero = (const unsigned char*) memchr(output, 0x00, size);
+  if (zero == NULL)
+    return size;
+
+  cursor.end = true;
+  return zero - output;
+}
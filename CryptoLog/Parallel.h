@@ -0,0 +1,225 @@
+#pragma once
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/* smallest range worth handing to another thread: 64 KiB of ciphertext */
+#define PARALLEL_MIN_BYTES (64 * 1024)
+
+namespace CryptoLog {
+  class ThreadPool {
+    public:
+      static ThreadPool& instance();
+      unsigned int size() const;
+      void run(unsigned int ntasks, const function<void(unsigned int)> &task);
+    private:
+      ThreadPool(unsigned int nthreads);
+      ~ThreadPool();
+      void worker();
+      void work();
+      vector<thread> workers;
+      mutex run_mutex, m;
+      condition_variable wake, done;
+      const function<void(unsigned int)> *job = NULL;
+      unsigned int job_size = 0, next = 0, pending = 0;
+      bool stop = false;
+  };
+
+  template <size_t block_size, class Range>
+  void parallel_ranges(size_t length, unsigned int threads, Range range);
+
+  template <size_t block_size, class Decrypt>
+  void parallel_decrypt(size_t length, const unsigned char first_iv[],
+                        const unsigned char *input, unsigned char *output,
+                        unsigned int threads, Decrypt decrypt);
+
+  /* out = in + add, for big endian counters; out may be in */
+  template <size_t block_size>
+  void add_counter(const unsigned char in[], size_t add, unsigned char out[]);
+
+  template <size_t block_size, class Crypt>
+  void parallel_ctr(size_t length, const unsigned char first_nonce_counter[],
+                    const unsigned char *input, unsigned char *output,
+                    unsigned int threads, Crypt crypt);
+}
+
+CryptoLog::ThreadPool& CryptoLog::ThreadPool::instance()
+{
+  static ThreadPool pool(thread::hardware_concurrency());
+  return pool;
+}
+
+CryptoLog::ThreadPool::ThreadPool(unsigned int nthreads)
+{
+  /* the thread calling run() does its share of the work */
+  for (unsigned int i = 1; i < nthreads; i++)
+    workers.push_back(thread(&ThreadPool::worker, this));
+}
+
+CryptoLog::ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock(m);
+    stop = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+unsigned int CryptoLog::ThreadPool::size() const
+{
+  return workers.size() + 1;
+}
+
+void CryptoLog::ThreadPool::run(unsigned int ntasks,
+                                const function<void(unsigned int)> &task)
+{
+  if (ntasks <= 1 || workers.empty())
+  {
+    for (unsigned int i = 0; i < ntasks; i++)
+      task(i);
+    return;
+  }
+
+  lock_guard<mutex> run_lock(run_mutex);
+  {
+    lock_guard<mutex> lock(m);
+    job = &task;
+    job_size = ntasks;
+    next = 0;
+    pending = ntasks;
+  }
+  wake.notify_all();
+
+  work();
+
+  unique_lock<mutex> lock(m);
+  done.wait(lock, [this] { return pending == 0; });
+  job = NULL;
+}
+
+void CryptoLog::ThreadPool::worker()
+{
+  for (;;)
+  {
+    {
+      unique_lock<mutex> lock(m);
+      wake.wait(lock, [this] { return stop || (job != NULL && next < job_size); });
+      if (stop)
+        return;
+    }
+    work();
+  }
+}
+
+void CryptoLog::ThreadPool::work()
+{
+  for (;;)
+  {
+    const function<void(unsigned int)> *task;
+    unsigned int i;
+    {
+      lock_guard<mutex> lock(m);
+      if (job == NULL || next >= job_size)
+        return;
+      task = job;
+      i = next++;
+    }
+
+    (*task)(i);
+
+    lock_guard<mutex> lock(m);
+    if (--pending == 0)
+      done.notify_all();
+  }
+}
+
+/*
+ * Splits length bytes into up to threads ranges (threads == 0 uses the
+ * whole pool) of at least PARALLEL_MIN_BYTES and runs range(first, last)
+ * for each of them on the pool. Ranges start on block boundaries; the
+ * last one also takes a partial trailing block.
+ */
+template <size_t block_size, class Range>
+void CryptoLog::parallel_ranges(size_t length, unsigned int threads, Range range)
+{
+  ThreadPool &pool = ThreadPool::instance();
+  size_t nblocks = length / block_size;
+  size_t ntasks = length / PARALLEL_MIN_BYTES;
+
+  if (threads == 0 || threads > pool.size())
+    threads = pool.size();
+  if (ntasks > threads)
+    ntasks = threads;
+  if (ntasks == 0)
+    ntasks = 1;
+
+  pool.run(ntasks, [&](unsigned int i) {
+    size_t first = nblocks * i / ntasks * block_size;
+    size_t last  = (i + 1 == ntasks) ? length : nblocks * (i + 1) / ntasks * block_size;
+
+    range(first, last);
+  });
+}
+
+/*
+ * CBC and CFB decryption of one block only need the ciphertext block
+ * before it, so each range is decrypted on its own with that block as the
+ * IV. decrypt(length, iv, input, output) is the cipher's decrypt call
+ * starting at a block boundary. input and output must not overlap.
+ */
+template <size_t block_size, class Decrypt>
+void CryptoLog::parallel_decrypt(size_t length, const unsigned char first_iv[],
+                                 const unsigned char *input, unsigned char *output,
+                                 unsigned int threads, Decrypt decrypt)
+{
+  parallel_ranges<block_size>(length, threads, [&](size_t first, size_t last) {
+    unsigned char iv[block_size];
+
+    if (first == 0)
+      memcpy(iv, first_iv, block_size);
+    else
+      memcpy(iv, input + first - block_size, block_size);
+
+    decrypt(last - first, iv, input + first, output + first);
+  });
+}
+
+template <size_t block_size>
+void CryptoLog::add_counter(const unsigned char in[], size_t add, unsigned char out[])
+{
+  unsigned int carry = 0;
+
+  for (size_t i = block_size; i > 0; i--)
+  {
+    carry += in[i - 1] + (unsigned int) (add & 0xFF);
+    out[i - 1] = (unsigned char) carry;
+    carry >>= 8;
+    add >>= 8;
+  }
+}
+
+/*
+ * The keystream block of block b is the encryption of the first counter
+ * plus b (a big endian integer), so every range starts from its own
+ * counter. crypt(length, nonce_counter, input, output) is the cipher's
+ * CTR call starting at a block boundary.
+ */
+template <size_t block_size, class Crypt>
+void CryptoLog::parallel_ctr(size_t length, const unsigned char first_nonce_counter[],
+                             const unsigned char *input, unsigned char *output,
+                             unsigned int threads, Crypt crypt)
+{
+  parallel_ranges<block_size>(length, threads, [&](size_t first, size_t last) {
+    unsigned char nonce_counter[block_size];
+    add_counter<block_size>(first_nonce_counter, first / block_size, nonce_counter);
+
+    crypt(last - first, nonce_counter, input + first, output + first);
+  });
+}
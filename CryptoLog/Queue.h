@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+using namespace std;
+
+/* the size the producer and the consumer positions are padded to */
+#define QUEUE_CACHE_LINE 64
+
+/*
+ * Bounded lock-free queue for many producers and a single consumer
+ * (D. Vyukov's bounded queue). Every cell carries a sequence number that
+ * tells whose turn it is: a producer claims a position with one CAS and
+ * publishes the item by bumping the sequence, the consumer takes the
+ * item and hands the cell to the producers of the next round.
+ */
+namespace CryptoLog {
+  template <class T>
+  class MPSCQueue {
+    public:
+      /* the capacity is rounded up to a power of two */
+      explicit MPSCQueue(size_t capacity);
+      /*
+       * Moves item in and sets pos to its position, counted from 0 in the
+       * order the consumer pops them; false, leaving item alone, if the
+       * queue is full.
+       */
+      bool push(T &item, size_t &pos);
+      /* consumer only; false if the queue is empty */
+      bool pop(T &item);
+      /* consumer only */
+      bool empty() const;
+    private:
+      struct Cell {
+        atomic<size_t> sequence;
+        T data;
+      };
+
+      unique_ptr<Cell[]> cells;
+      size_t mask;
+      char pad0[QUEUE_CACHE_LINE];
+      atomic<size_t> enqueue_pos;
+      char pad1[QUEUE_CACHE_LINE - sizeof(atomic<size_t>)];
+      size_t dequeue_pos;
+  };
+}
+
+template <class T>
+CryptoLog::MPSCQueue<T>::MPSCQueue(size_t capacity)
+{
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+
+  cells.reset(new Cell[size]);
+  mask = size - 1;
+
+  for (size_t i = 0; i < size; i++)
+    cells[i].sequence.store(i, memory_order_relaxed);
+
+  enqueue_pos.store(0, memory_order_relaxed);
+  dequeue_pos = 0;
+}
+
+template <class T>
+bool CryptoLog::MPSCQueue<T>::push(T &item, size_t &pos)
+{
+  Cell *cell;
+  pos = enqueue_pos.load(memory_order_relaxed);
+
+  for (;;)
+  {
+    cell = &cells[pos & mask];
+    size_t seq = cell->sequence.load(memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+
+    if (diff == 0)
+    {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+      return false;
+    else
+      pos = enqueue_pos.load(memory_order_relaxed);
+  }
+
+  cell->data = move(item);
+  cell->sequence.store(pos + 1, memory_order_release);
+
+  return true;
+}
+
+template <class T>
+bool CryptoLog::MPSCQueue<T>::pop(T &item)
+{
+  Cell *cell = &cells[dequeue_pos & mask];
+
+  if (cell->sequence.load(memory_order_acquire) != dequeue_pos + 1)
+    return false;
+
+  item = move(cell->data);
+  cell->sequence.store(dequeue_pos + mask + 1, memory_order_release);
+  dequeue_pos++;
+
+  return true;
+}
+
+template <class T>
+bool CryptoLog::MPSCQueue<T>::empty() const
+{
+  return cells[dequeue_pos & mask].sequence.load(memory_order_acquire) != dequeue_pos + 1;
+}
@@ -0,0 +1,334 @@
+#pragma once
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "CryptoLog.h"
+#include "Frame.h"
+#include "Sink.h"
+#if !_WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+/* the ciphertext a Reader decrypts at a time, a multiple of every block size */
+#define READER_CHUNK_SIZE (4*1024*1024)
+/* the ciphertext a Reader keeps mapped at a time, a multiple of READER_CHUNK_SIZE */
+#define READER_MAP_WINDOW (64*1024*1024)
+
+/*
+ * Reads the plaintext of a log a chunk at a time, so the memory it needs
+ * does not grow with the log:
+ *
+ *   Blowfish_CBC::Reader r = log.reader();
+ *   const char *data;
+ *   size_t size;
+ *   while (r.next(data, size))
+ *     ...
+ *
+ * next() hands back the next slice of plaintext, valid until the
+ * following call; the slices joined are what get_plain_text() returns.
+ * In a framed log (see Frame.h) every slice is one record, the payload of
+ * one write(); a record cut short at the end of the file, by a crash in
+ * the middle of a write, is not returned.
+ * The reader sees what was written before reader() was called. It reads
+ * through the log's sink and must not outlive the log or a set_sink()
+ * call; the log may be written meanwhile.
+ *
+ * Where the sink offers its file descriptor (see Sink::descriptor()) the
+ * ciphertext is not read at all: the reader maps it READER_MAP_WINDOW
+ * bytes at a time, tells the kernel it is read sequentially so it reads
+ * ahead, and decrypts straight from the mapping. It maps a duplicate of
+ * the descriptor, which stays valid if the log reopens its file.
+ */
+namespace CryptoLog {
+  template <class Cipher, template <class> class Mode>
+  class Reader {
+    public:
+      Reader(const typename Cipher::context &ctx, Sink &sink, mutex &io_mutex,
+             unsigned int threads, bool framed);
+      Reader(Reader &&other);
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
+      ~Reader();
+      bool next(const char *&data, size_t &size);
+#if __cplusplus >= 201703L
+      bool next(string_view &view);
+#endif
+      /* the ciphertext not read yet, no less than the plaintext still to come */
+      uint64_t left() const { return end - offset; }
+    private:
+      enum State { FRAME_GAP, FRAME_LENGTH, FRAME_PAYLOAD };
+
+      bool next_chunk();
+      bool next_record(const char *&data, size_t &size);
+      const unsigned char* input(size_t size);
+      void unmap();
+
+      /* a copy of the key schedule, wiped with the reader */
+      typename Cipher::context ctx;
+      Sink *sink;
+      mutex *io_mutex;
+      unsigned int threads;
+      typename Mode<Cipher>::Cursor cursor;
+      /* the next ciphertext byte and the end of what is read */
+      uint64_t offset, end;
+      vector<unsigned char> in, out;
+      /* the decrypted bytes in out and how many of them were used */
+      size_t avail = 0, pos = 0;
+      /* where the record parser is, see next_record() */
+      bool framed;
+      State state = FRAME_GAP;
+      unsigned char flags = 0;
+      uint64_t remaining = 0;
+      unsigned int shift = 0;
+      string record;
+      /* the mapped window of the file, if it is mapped */
+      int fd = -1;
+      unsigned char *map = NULL;
+      uint64_t map_offset = 0;
+      size_t map_size = 0;
+  };
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Reader<Cipher, Mode>::Reader(const typename Cipher::context &ctx, Sink &sink,
+                                        mutex &io_mutex, unsigned int threads, bool framed)
+  : ctx(ctx), sink(&sink), io_mutex(&io_mutex), threads(threads), framed(framed)
+{
+  unsigned char header[Mode<Cipher>::header_size];
+
+  {
+    lock_guard<mutex> lock(io_mutex);
+    sink.read_at(header, Mode<Cipher>::header_size, 0);
+    end = sink.size();
+#if !_WIN32
+    if (sink.descriptor() != -1)
+      fd = dup(sink.descriptor());
+#endif
+  }
+
+  Mode<Cipher>::start(header, cursor);
+  offset = Mode<Cipher>::header_size;
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Reader<Cipher, Mode>::Reader(Reader &&other)
+  : ctx(other.ctx), sink(other.sink), io_mutex(other.io_mutex), threads(other.threads),
+    cursor(other.cursor), offset(other.offset), end(other.end),
+    in(move(other.in)), out(move(other.out)), avail(other.avail), pos(other.pos),
+    framed(other.framed), state(other.state), flags(other.flags),
+    remaining(other.remaining), shift(other.shift), record(move(other.record)),
+    fd(other.fd), map(other.map), map_offset(other.map_offset), map_size(other.map_size)
+{
+  other.fd = -1;
+  other.map = NULL;
+}
+
+template <class Cipher, template <class> class Mode>
+CryptoLog::Reader<Cipher, Mode>::~Reader()
+{
+  unmap();
+#if !_WIN32
+  if (fd != -1)
+    ::close(fd);
+#endif
+  Cipher::free(&ctx);
+}
+
+template <class Cipher, template <class> class Mode>
+void CryptoLog::Reader<Cipher, Mode>::unmap()
+{
+#if !_WIN32
+  if (map != NULL)
+    munmap(map, map_size);
+#endif
+  map = NULL;
+}
+
+/*
+ * The next size bytes of ciphertext: in the mapped window, which moves on
+ * once they are past it, or read into the buffer where mapping fails.
+ */
+template <class Cipher, template <class> class Mode>
+const unsigned char* CryptoLog::Reader<Cipher, Mode>::input(size_t size)
+{
+#if !_WIN32
+  if (map != NULL && offset + size <= map_offset + map_size)
+    return map + (offset - map_offset);
+
+  if (fd != -1)
+  {
+    unmap();
+
+    /* mmap() wants the offset on a page boundary */
+    map_offset = offset & ~((uint64_t) sysconf(_SC_PAGESIZE) - 1);
+    map_size = (size_t) (offset - map_offset) + READER_MAP_WINDOW;
+    if (map_size > end - map_offset)
+      map_size = (size_t) (end - map_offset);
+
+    void *p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, map_offset);
+    if (p != MAP_FAILED)
+    {
+      map = (unsigned char*) p;
+      madvise(map, map_size, MADV_SEQUENTIAL);
+      madvise(map, map_size, MADV_WILLNEED);
+      return map + (offset - map_offset);
+    }
+
+    ::close(fd);
+    fd = -1;
+  }
+#endif
+
+  in.resize(size);
+  {
+    lock_guard<mutex> lock(*io_mutex);
+    sink->read_at(in.data(), size, offset);
+  }
+  return in.data();
+}
+
+/* decrypts the next chunk into out, false at the end */
+template <class Cipher, template <class> class Mode>
+bool CryptoLog::Reader<Cipher, Mode>::next_chunk()
+{
+  if (offset >= end)
+  {
+    unmap();
+    return false;
+  }
+
+  size_t n = READER_CHUNK_SIZE;
+  if (n > end - offset)
+    n = end - offset;
+
+  const unsigned char *p = input(n);
+  out.resize(n);
+  offset += n;
+
+  Mode<Cipher>::decrypt(&ctx, cursor, p, n, out.data(), threads);
+  avail = n;
+  pos = 0;
+
+  return true;
+}
+
+template <class Cipher, template <class> class Mode>
+bool CryptoLog::Reader<Cipher, Mode>::next(const char *&data, size_t &size)
+{
+  if (framed)
+    return next_record(data, size);
+
+  /* chunks that are all padding yield nothing, they are skipped */
+  while (!Mode<Cipher>::ended(cursor) && next_chunk())
+  {
+    size = Mode<Cipher>::text(cursor, out.data(), avail);
+    if (size > 0)
+    {
+      data = (const char*) out.data();
+      return true;
+    }
+  }
+
+  unmap();
+  return false;
+}
+
+/*
+ * Parses the records out of the decrypted chunks. A record within one
+ * chunk is handed back where it is, one that spans chunks is collected
+ * in record first.
+ */
+template <class Cipher, template <class> class Mode>
+bool CryptoLog::Reader<Cipher, Mode>::next_record(const char *&data, size_t &size)
+{
+  record.clear();
+
+  for (;;)
+  {
+    if (state == FRAME_PAYLOAD && remaining == 0)
+    {
+      state = FRAME_GAP;
+      if ((flags & ~FRAME_FLAGS) != 0)
+      {
+        record.clear();
+        continue;
+      }
+
+      data = record.data();
+      size = record.size();
+      return true;
+    }
+
+    if (pos == avail && !next_chunk())
+      return false;
+
+    const unsigned char *p = out.data();
+    switch (state)
+    {
+      case FRAME_GAP:
+        while (pos < avail && p[pos] == 0x00)
+          pos++;
+        if (pos < avail)
+        {
+          flags = p[pos++];
+          remaining = 0;
+          shift = 0;
+          state = FRAME_LENGTH;
+        }
+        break;
+
+      case FRAME_LENGTH:
+        if (shift > 63)
+          throw runtime_error("Corrupted log record");
+        remaining |= (uint64_t) (p[pos] & 0x7F) << shift;
+        shift += 7;
+        if ((p[pos++] & 0x80) == 0)
+          state = FRAME_PAYLOAD;
+        break;
+
+      case FRAME_PAYLOAD:
+        {
+          size_t n = avail - pos;
+          if (n > remaining)
+            n = remaining;
+
+          if (record.empty() && n == remaining && (flags & ~FRAME_FLAGS) == 0)
+          {
+            data = (const char*) p + pos;
+            size = n;
+            pos += n;
+            remaining = 0;
+            state = FRAME_GAP;
+            return true;
+          }
+
+          if ((flags & ~FRAME_FLAGS) == 0)
+            record.append((const char*) p + pos, n);
+          pos += n;
+          remaining -= n;
+        }
+        break;
+    }
+  }
+}
+
+#if __cplusplus >= 201703L
+template <class Cipher, template <class> class Mode>
+bool CryptoLog::Reader<Cipher, Mode>::next(string_view &view)
+{
+  const char *data;
+  size_t size;
+
+  if (!next(data, size))
+    return false;
+
+  view = string_view(data, size);
+  return true;
+}
+#endif
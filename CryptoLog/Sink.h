@@ -0,0 +1,407 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include "CryptoLog.h"
+#if _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+/* the append buffer of FdSink */
+#define SINK_BUFFER_SIZE (256*1024)
+#define SINK_ALIGNMENT   4096
+
+/*
+ * Where a log keeps its bytes. The modes only append ciphertext, read
+ * their state back and rewrite their header in place, so that is all a
+ * sink has to do:
+ *
+ *   open()      opens the file, creating it if it does not exist
+ *   append()    adds bytes at the end, possibly buffered
+ *   write_at()  overwrites bytes in place (the header)
+ *   read_at()   reads bytes, including appended ones not flushed yet
+ *   flush()     hands the buffered bytes to the operating system
+ *   sync()      flushes and waits until the data is on stable storage
+ *   size()      the size of the file with the buffered bytes
+ *
+ * size() is the logical end the sink keeps itself, the modes never look
+ * at the end of the file, so space reserved past it is not mistaken for
+ * ciphertext (see set_preallocation()).
+ */
+namespace CryptoLog {
+  class Sink {
+    public:
+      virtual ~Sink() {};
+      virtual void open(const string &filename) = 0;
+      virtual void close() = 0;
+      virtual bool is_open() const = 0;
+      virtual void append(const void *data, size_t size) = 0;
+      virtual void write_at(const void *data, size_t size, uint64_t offset) = 0;
+      virtual void read_at(void *data, size_t size, uint64_t offset) = 0;
+      virtual void flush() = 0;
+      virtual void sync() = 0;
+      virtual uint64_t size() = 0;
+      /*
+       * Reserves the file ahead of its end in chunks of the given size,
+       * so it grows one large extent at a time instead of a few bytes per
+       * append; 0 turns it off. The reserved space does not count in the
+       * file size. A hint: sinks that cannot reserve ignore it.
+       */
+      virtual void set_preallocation(uint64_t chunk) {}
+      /*
+       * The descriptor of the open file once flush() returned, for readers
+       * that map it (see Reader.h); -1 where there is none, or where the
+       * sink reads in bulk better through read_at() itself.
+       */
+      virtual int descriptor() const { return -1; }
+  };
+
+#if !_WIN32
+  /*
+   * The preallocation of the fd sinks: the file is reserved with
+   * fallocate(FALLOC_FL_KEEP_SIZE) up to the next multiple of the chunk
+   * size past the highest offset written. Where that is not supported it
+   * gives up after the first try.
+   */
+  class Preallocator {
+    public:
+      void set_chunk(uint64_t chunk) { this->chunk = chunk; }
+      /* the file was opened with this size */
+      void reset(uint64_t end) { allocated = end; }
+      /* called before writing up to end */
+      void reserve(int fd, uint64_t end);
+    private:
+      uint64_t chunk = 0, allocated = 0;
+  };
+#endif
+
+  /* the portable sink, through a stdio stream */
+  class StdioSink : public Sink {
+    public:
+      ~StdioSink() { close(); }
+      virtual void open(const string &filename);
+      virtual void close();
+      virtual bool is_open() const { return fp != NULL; }
+      virtual void append(const void *data, size_t size);
+      virtual void write_at(const void *data, size_t size, uint64_t offset);
+      virtual void read_at(void *data, size_t size, uint64_t offset);
+      virtual void flush();
+      virtual void sync();
+      virtual uint64_t size();
+#if !_WIN32
+      virtual int descriptor() const { return fp != NULL ? fileno(fp) : -1; }
+#endif
+    private:
+      FILE *fp = NULL;
+      string filename;
+  };
+
+#if !_WIN32
+  /*
+   * A sink on a raw file descriptor with its own aligned append buffer,
+   * written with pwrite/pwritev at an offset it tracks itself, so an
+   * append needs neither a seek nor a copy through stdio. The file is not
+   * opened with O_APPEND: on Linux that makes pwrite ignore its offset,
+   * and the CFB and CTR modes rewrite their header in place.
+   */
+  class FdSink : public Sink {
+    public:
+      FdSink();
+      ~FdSink();
+      virtual void open(const string &filename);
+      virtual void close();
+      virtual bool is_open() const { return fd != -1; }
+      virtual void append(const void *data, size_t size);
+      virtual void write_at(const void *data, size_t size, uint64_t offset);
+      virtual void read_at(void *data, size_t size, uint64_t offset);
+      virtual void flush();
+      virtual void sync();
+      virtual uint64_t size() { return end; }
+      virtual void set_preallocation(uint64_t chunk) { prealloc.set_chunk(chunk); }
+      virtual int descriptor() const { return fd; }
+    private:
+      void write_fully(const struct iovec *iov, int iovcnt, uint64_t offset);
+      int fd = -1;
+      string filename;
+      unsigned char *buff;
+      size_t buffered = 0;
+      /* the offset the buffer starts at and the logical end of the file */
+      uint64_t buff_offset = 0, end = 0;
+      Preallocator prealloc;
+  };
+#endif
+
+  /* the sink new logs use */
+  Sink* default_sink();
+#if !_WIN32
+  /* fdatasync where there is one */
+  int sync_fd(int fd);
+#endif
+}
+
+void CryptoLog::StdioSink::open(const string &filename)
+{
+  close();
+
+  fp = fopen(filename.c_str(), "rb+");
+  if (fp == NULL)
+    fp = fopen(filename.c_str(), "wb+");
+  if (fp == NULL)
+    throw runtime_error("Could not open file: " + filename);
+
+  this->filename = filename;
+}
+
+void CryptoLog::StdioSink::close()
+{
+  if (fp == NULL)
+    return;
+
+  fclose(fp);
+  fp = NULL;
+}
+
+void CryptoLog::StdioSink::append(const void *data, size_t size)
+{
+  fseek(fp, 0, SEEK_END);
+  if (fwrite(data, sizeof(unsigned char), size, fp) != size)
+    throw runtime_error("Could not write file: " + filename);
+}
+
+void CryptoLog::StdioSink::write_at(const void *data, size_t size, uint64_t offset)
+{
+  fseek(fp, (long) offset, SEEK_SET);
+  if (fwrite(data, sizeof(unsigned char), size, fp) != size)
+    throw runtime_error("Could not write file: " + filename);
+}
+
+void CryptoLog::StdioSink::read_at(void *data, size_t size, uint64_t offset)
+{
+  fseek(fp, (long) offset, SEEK_SET);
+  if (fread(data, sizeof(unsigned char), size, fp) != size)
+    throw runtime_error("Could not read file: " + filename);
+}
+
+void CryptoLog::StdioSink::flush()
+{
+  fflush(fp);
+}
+
+void CryptoLog::StdioSink::sync()
+{
+  fflush(fp);
+#if _WIN32
+  if (_commit(_fileno(fp)) != 0)
+#else
+  if (sync_fd(fileno(fp)) != 0)
+#endif
+    throw runtime_error("Could not sync file: " + filename);
+}
+
+uint64_t CryptoLog::StdioSink::size()
+{
+  fseek(fp, 0, SEEK_END);
+  return ftell(fp);
+}
+
+#if !_WIN32
+CryptoLog::FdSink::FdSink()
+{
+  void *p;
+  if (posix_memalign(&p, SINK_ALIGNMENT, SINK_BUFFER_SIZE) != 0)
+    throw runtime_error("Could not allocate the sink buffer");
+  buff = (unsigned char*) p;
+}
+
+CryptoLog::FdSink::~FdSink()
+{
+  close();
+  free(buff);
+}
+
+void CryptoLog::FdSink::open(const string &filename)
+{
+  close();
+
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1)
+    throw runtime_error("Could not open file: " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    ::close(fd);
+    fd = -1;
+    throw runtime_error("Could not open file: " + filename);
+  }
+
+  this->filename = filename;
+  buffered = 0;
+  buff_offset = end = st.st_size;
+  prealloc.reset(end);
+}
+
+void CryptoLog::FdSink::close()
+{
+  if (fd == -1)
+    return;
+
+  flush();
+  ::close(fd);
+  fd = -1;
+}
+
+void CryptoLog::FdSink::write_fully(const struct iovec *iov, int iovcnt, uint64_t offset)
+{
+  struct iovec vec[2] = {};
+  size_t left = iov_size(iov, iovcnt);
+
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  prealloc.reserve(fd, offset + left);
+
+  while (left > 0)
+  {
+    ssize_t n = pwritev(fd, vec, iovcnt, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw runtime_error("Could not write file: " + filename);
+
+    left -= n;
+    offset += n;
+    /* a short write: skip what went out */
+    while (iovcnt > 0 && (size_t) n >= vec[0].iov_len)
+    {
+      n -= vec[0].iov_len;
+      vec[0] = vec[1];
+      iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+      vec[0].iov_base = (unsigned char*) vec[0].iov_base + n;
+      vec[0].iov_len -= n;
+    }
+  }
+}
+
+/*
+ * Small appends are collected in the buffer; one that does not fit goes
+ * out together with the buffer in a single pwritev.
+ */
+void CryptoLog::FdSink::append(const void *data, size_t size)
+{
+  if (buffered + size <= SINK_BUFFER_SIZE)
+  {
+    memcpy(buff + buffered, data, size);
+    buffered += size;
+  }
+  else
+  {
+    struct iovec iov[2] = { { buff, buffered }, { (void*) data, size } };
+    write_fully(iov, 2, buff_offset);
+    buffered = 0;
+    buff_offset = end + size;
+  }
+
+  end += size;
+}
+
+void CryptoLog::FdSink::write_at(const void *data, size_t size, uint64_t offset)
+{
+  if (offset + size > buff_offset)
+    flush();
+
+  struct iovec iov = { (void*) data, size };
+  write_fully(&iov, 1, offset);
+}
+
+void CryptoLog::FdSink::read_at(void *data, size_t size, uint64_t offset)
+{
+  if (offset + size > buff_offset)
+    flush();
+
+  unsigned char *out = (unsigned char*) data;
+  while (size > 0)
+  {
+    ssize_t n = pread(fd, out, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw runtime_error("Could not read file: " + filename);
+
+    out += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+void CryptoLog::FdSink::flush()
+{
+  if (buffered == 0)
+    return;
+
+  struct iovec iov = { buff, buffered };
+  write_fully(&iov, 1, buff_offset);
+
+  buff_offset += buffered;
+  buffered = 0;
+}
+
+void CryptoLog::FdSink::sync()
+{
+  flush();
+  if (sync_fd(fd) != 0)
+    throw runtime_error("Could not sync file: " + filename);
+}
+
+void CryptoLog::Preallocator::reserve(int fd, uint64_t end)
+{
+  if (chunk == 0 || end <= allocated)
+    return;
+
+  uint64_t to = (end + chunk - 1) / chunk * chunk;
+  int ret = -1;
+#if defined(FALLOC_FL_KEEP_SIZE)
+  do
+    ret = fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, to - allocated);
+  while (ret == -1 && errno == EINTR);
+#endif
+
+  if (ret == 0)
+    allocated = to;
+  else
+    chunk = 0;
+}
+
+int CryptoLog::sync_fd(int fd)
+{
+  int ret;
+  do
+#if __linux__
+    ret = fdatasync(fd);
+#else
+    ret = fsync(fd);
+#endif
+  while (ret == -1 && errno == EINTR);
+  return ret;
+}
+#endif
+
+CryptoLog::Sink* CryptoLog::default_sink()
+{
+#if _WIN32
+  return new StdioSink;
+#else
+  return new FdSink;
+#endif
+}
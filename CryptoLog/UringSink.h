@@ -0,0 +1,610 @@
+#pragma once
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include "Sink.h"
+#if __linux__ && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CRYPTOLOG_HAVE_URING 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+using namespace std;
+
+/* the append buffers one UringSink keeps in flight */
+#define URING_BUFFERS      4
+/* bulk reads are split into chunks of this size, this many in flight */
+#define URING_READ_CHUNK   (1024*1024)
+#define URING_READ_DEPTH   8
+#define URING_QUEUE_DEPTH  16
+
+/*
+ * An io_uring back-end for the sink layer (see Sink.h). Appends fill one
+ * of a few aligned buffers; a full buffer is submitted as an asynchronous
+ * write and the next one is filled meanwhile, so the caller only waits
+ * for the disk when every buffer is still in flight. read_at() splits a
+ * bulk read into chunks and keeps several of them in flight at once; the
+ * sink offers no descriptor() to map, so readers (see Reader.h) go
+ * through it.
+ * sync() queues an fdatasync behind the writes in flight (IOSQE_IO_DRAIN)
+ * instead of waiting for them first.
+ *
+ * The ring is set up with the raw system calls, so liburing is not
+ * needed. uring_sink() falls back to an FdSink where io_uring is not
+ * available (an old kernel, a seccomp filter, another platform).
+ */
+namespace CryptoLog {
+#if CRYPTOLOG_HAVE_URING
+  class Uring {
+    public:
+      explicit Uring(unsigned entries);
+      ~Uring();
+      /* a free submission entry, or NULL if the submission queue is full */
+      struct io_uring_sqe* get_sqe();
+      /* submits the queued entries and waits for wait_nr completions */
+      void enter(unsigned wait_nr);
+      /* takes the next completion, if there is one */
+      bool pop(struct io_uring_cqe &cqe);
+    private:
+      int fd;
+      void *sq_ptr, *cq_ptr;
+      size_t sq_size, cq_size;
+      struct io_uring_sqe *sqes;
+      unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+      unsigned *cq_head, *cq_tail, *cq_mask;
+      struct io_uring_cqe *cqes;
+      unsigned entries, to_submit = 0;
+  };
+
+  class UringSink : public Sink {
+    public:
+      UringSink();
+      ~UringSink();
+      virtual void open(const string &filename);
+      virtual void close();
+      virtual bool is_open() const { return fd != -1; }
+      virtual void append(const void *data, size_t size);
+      virtual void write_at(const void *data, size_t size, uint64_t offset);
+      virtual void read_at(void *data, size_t size, uint64_t offset);
+      virtual void flush();
+      virtual void sync();
+      virtual uint64_t size() { return end; }
+      virtual void set_preallocation(uint64_t chunk) { prealloc.set_chunk(chunk); }
+    private:
+      struct Read {
+        unsigned char *data;
+        size_t size;
+        uint64_t offset;
+      };
+
+      void submit_buffer();
+      void submit_read(unsigned i);
+      void reap(unsigned wait_nr);
+      void complete(const struct io_uring_cqe &cqe);
+      void check_error();
+
+      Uring ring;
+      int fd = -1;
+      string filename;
+      unsigned char *buffs[URING_BUFFERS];
+      /* the length and the offset of a buffer in flight, 0 if it is free */
+      size_t busy_size[URING_BUFFERS];
+      uint64_t busy_offset[URING_BUFFERS];
+      unsigned current = 0, in_flight = 0;
+      size_t buffered = 0;
+      /* where the current buffer goes, the logical end, and up to where every write completed */
+      uint64_t buff_offset = 0, end = 0, written_end = 0;
+      Read reads[URING_READ_DEPTH];
+      int error = 0;
+      Preallocator prealloc;
+  };
+#endif
+
+  Sink* uring_sink();
+}
+
+#if CRYPTOLOG_HAVE_URING
+/* the user_data of reads and syncs; writes use the buffer index */
+#define URING_READ_TAG 0x100
+#define URING_SYNC_TAG 0x200
+
+CryptoLog::Uring::Uring(unsigned entries)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    throw runtime_error("io_uring is not available");
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+  {
+    ::close(fd);
+    throw runtime_error("io_uring is not available");
+  }
+
+  cq_ptr = sq_ptr;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+    {
+      munmap(sq_ptr, sq_size);
+      ::close(fd);
+      throw runtime_error("io_uring is not available");
+    }
+  }
+
+  sqes = (struct io_uring_sqe*) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+  {
+    if (cq_ptr != sq_ptr)
+      munmap(cq_ptr, cq_size);
+    munmap(sq_ptr, sq_size);
+    ::close(fd);
+    throw runtime_error("io_uring is not available");
+  }
+
+  unsigned char *sq = (unsigned char*) sq_ptr, *cq = (unsigned char*) cq_ptr;
+  sq_head  = (unsigned*) (sq + p.sq_off.head);
+  sq_tail  = (unsigned*) (sq + p.sq_off.tail);
+  sq_mask  = (unsigned*) (sq + p.sq_off.ring_mask);
+  sq_array = (unsigned*) (sq + p.sq_off.array);
+  cq_head  = (unsigned*) (cq + p.cq_off.head);
+  cq_tail  = (unsigned*) (cq + p.cq_off.tail);
+  cq_mask  = (unsigned*) (cq + p.cq_off.ring_mask);
+  cqes     = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+  this->entries = p.sq_entries;
+}
+
+CryptoLog::Uring::~Uring()
+{
+  munmap(sqes, entries * sizeof(struct io_uring_sqe));
+  if (cq_ptr != sq_ptr)
+    munmap(cq_ptr, cq_size);
+  munmap(sq_ptr, sq_size);
+  ::close(fd);
+}
+
+struct io_uring_sqe* CryptoLog::Uring::get_sqe()
+{
+  unsigned tail = *sq_tail;
+
+  if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries)
+    return NULL;
+
+  unsigned index = tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  to_submit++;
+
+  return sqe;
+}
+
+void CryptoLog::Uring::enter(unsigned wait_nr)
+{
+  for (;;)
+  {
+    int ret = (int) syscall(__NR_io_uring_enter, fd, to_submit, wait_nr,
+                            wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret >= 0)
+    {
+      to_submit -= (unsigned) ret;
+      if (to_submit == 0 || wait_nr == 0)
+        return;
+    }
+    else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      throw runtime_error("io_uring_enter failed");
+  }
+}
+
+bool CryptoLog::Uring::pop(struct io_uring_cqe &cqe)
+{
+  unsigned head = *cq_head;
+
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    return false;
+
+  cqe = cqes[head & *cq_mask];
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+CryptoLog::UringSink::UringSink() : ring(URING_QUEUE_DEPTH)
+{
+  for (unsigned i = 0; i < URING_BUFFERS; i++)
+  {
+    void *p;
+    if (posix_memalign(&p, SINK_ALIGNMENT, SINK_BUFFER_SIZE) != 0)
+    {
+      while (i-- > 0)
+        free(buffs[i]);
+      throw runtime_error("Could not allocate the sink buffer");
+    }
+    buffs[i] = (unsigned char*) p;
+    busy_size[i] = 0;
+  }
+}
+
+CryptoLog::UringSink::~UringSink()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+
+  /* the kernel may still write from a buffer after a failed close */
+  while (in_flight > 0)
+    reap(1);
+
+  for (unsigned i = 0; i < URING_BUFFERS; i++)
+    free(buffs[i]);
+}
+
+void CryptoLog::UringSink::open(const string &filename)
+{
+  close();
+
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1)
+    throw runtime_error("Could not open file: " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    ::close(fd);
+    fd = -1;
+    throw runtime_error("Could not open file: " + filename);
+  }
+
+  this->filename = filename;
+  buffered = 0;
+  error = 0;
+  buff_offset = end = written_end = st.st_size;
+  prealloc.reset(end);
+}
+
+void CryptoLog::UringSink::close()
+{
+  if (fd == -1)
+    return;
+
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+    ::close(fd);
+    fd = -1;
+    throw;
+  }
+
+  ::close(fd);
+  fd = -1;
+}
+
+void CryptoLog::UringSink::check_error()
+{
+  if (error == 0)
+    return;
+
+  error = 0;
+  throw runtime_error("Could not write file: " + filename);
+}
+
+/* hands the current buffer to the kernel and moves on to a free one */
+void CryptoLog::UringSink::submit_buffer()
+{
+  if (buffered == 0)
+    return;
+
+  /* once a chunk, synchronously; the writes in flight do not depend on it */
+  prealloc.reserve(fd, buff_offset + buffered);
+
+  struct io_uring_sqe *sqe;
+  while ((sqe = ring.get_sqe()) == NULL)
+    reap(1);
+
+  sqe->opcode    = IORING_OP_WRITE;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t) (uintptr_t) buffs[current];
+  sqe->len       = (unsigned) buffered;
+  sqe->off       = buff_offset;
+  sqe->user_data = current;
+
+  busy_size[current]   = buffered;
+  busy_offset[current] = buff_offset;
+  in_flight++;
+  ring.enter(0);
+
+  buff_offset += buffered;
+  buffered = 0;
+  current = (current + 1) % URING_BUFFERS;
+
+  while (busy_size[current] != 0)
+    reap(1);
+}
+
+void CryptoLog::UringSink::reap(unsigned wait_nr)
+{
+  struct io_uring_cqe cqe;
+
+  if (!ring.pop(cqe))
+  {
+    ring.enter(wait_nr);
+    if (!ring.pop(cqe))
+      return;
+  }
+
+  do
+    complete(cqe);
+  while (ring.pop(cqe));
+}
+
+void CryptoLog::UringSink::complete(const struct io_uring_cqe &cqe)
+{
+  if (cqe.user_data == URING_SYNC_TAG)
+  {
+    in_flight--;
+    if (cqe.res < 0)
+      error = -cqe.res;
+    return;
+  }
+
+  if (cqe.user_data >= URING_READ_TAG)
+  {
+    Read &r = reads[cqe.user_data - URING_READ_TAG];
+    in_flight--;
+
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+      submit_read(cqe.user_data - URING_READ_TAG);
+    else if (cqe.res <= 0)
+    {
+      error = (cqe.res < 0) ? -cqe.res : EIO;
+      r.size = 0;
+    }
+    else
+    {
+      /* a short read: ask for the rest */
+      r.data   += cqe.res;
+      r.size   -= cqe.res;
+      r.offset += cqe.res;
+      if (r.size > 0)
+        submit_read(cqe.user_data - URING_READ_TAG);
+    }
+    return;
+  }
+
+  unsigned i = (unsigned) cqe.user_data;
+  size_t done = (cqe.res > 0) ? (size_t) cqe.res : 0;
+
+  if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN)
+    error = -cqe.res;
+  else if (done < busy_size[i])
+  {
+    /* a short write, rare on regular files: finish it synchronously */
+    unsigned char *p = buffs[i] + done;
+    size_t left = busy_size[i] - done;
+    uint64_t offset = busy_offset[i] + done;
+
+    while (left > 0)
+    {
+      ssize_t n = pwrite(fd, p, left, offset);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        error = (n < 0) ? errno : EIO;
+        break;
+      }
+      p += n;
+      left -= n;
+      offset += n;
+    }
+  }
+
+  busy_size[i] = 0;
+  in_flight--;
+}
+
+void CryptoLog::UringSink::append(const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*) data;
+
+  check_error();
+
+  /* the caller reuses its buffer, so everything is copied into ours */
+  while (size > 0)
+  {
+    size_t n = SINK_BUFFER_SIZE - buffered;
+    if (n > size)
+      n = size;
+
+    memcpy(buffs[current] + buffered, p, n);
+    buffered += n;
+    end += n;
+    p += n;
+    size -= n;
+
+    if (buffered == SINK_BUFFER_SIZE)
+      submit_buffer();
+  }
+}
+
+void CryptoLog::UringSink::flush()
+{
+  submit_buffer();
+
+  while (in_flight > 0)
+    reap(1);
+
+  written_end = buff_offset;
+  check_error();
+}
+
+void CryptoLog::UringSink::sync()
+{
+  submit_buffer();
+
+  struct io_uring_sqe *sqe;
+  while ((sqe = ring.get_sqe()) == NULL)
+    reap(1);
+
+  sqe->opcode      = IORING_OP_FSYNC;
+  sqe->flags       = IOSQE_IO_DRAIN;
+  sqe->fd          = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data   = URING_SYNC_TAG;
+
+  in_flight++;
+  ring.enter(0);
+
+  while (in_flight > 0)
+    reap(1);
+
+  written_end = buff_offset;
+  if (error != 0)
+  {
+    error = 0;
+    throw runtime_error("Could not sync file: " + filename);
+  }
+}
+
+void CryptoLog::UringSink::write_at(const void *data, size_t size, uint64_t offset)
+{
+  /* header rewrites are rare, they go out synchronously behind the appends */
+  flush();
+
+  const unsigned char *p = (const unsigned char*) data;
+  while (size > 0)
+  {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw runtime_error("Could not write file: " + filename);
+
+    p += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+void CryptoLog::UringSink::submit_read(unsigned i)
+{
+  struct io_uring_sqe *sqe;
+  while ((sqe = ring.get_sqe()) == NULL)
+    reap(1);
+
+  size_t n = reads[i].size;
+  if (n > URING_READ_CHUNK)
+    n = URING_READ_CHUNK;
+
+  sqe->opcode    = IORING_OP_READ;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t) (uintptr_t) reads[i].data;
+  sqe->len       = (unsigned) n;
+  sqe->off       = reads[i].offset;
+  sqe->user_data = URING_READ_TAG + i;
+
+  in_flight++;
+  ring.enter(0);
+}
+
+/*
+ * Every slot reads one chunk at a time and takes the next unread chunk
+ * when it is done, so up to URING_READ_DEPTH chunks are in flight.
+ */
+void CryptoLog::UringSink::read_at(void *data, size_t size, uint64_t offset)
+{
+  if (offset + size > written_end)
+    flush();
+
+  check_error();
+
+  unsigned char *p = (unsigned char*) data;
+  unsigned active = 0;
+
+  for (unsigned i = 0; i < URING_READ_DEPTH; i++)
+    reads[i].size = 0;
+
+  for (;;)
+  {
+    for (unsigned i = 0; i < URING_READ_DEPTH && size > 0; i++)
+    {
+      if (reads[i].size != 0)
+        continue;
+
+      size_t n = (size > URING_READ_CHUNK) ? URING_READ_CHUNK : size;
+      reads[i].data   = p;
+      reads[i].size   = n;
+      reads[i].offset = offset;
+      submit_read(i);
+
+      p += n;
+      offset += n;
+      size -= n;
+    }
+
+    active = 0;
+    for (unsigned i = 0; i < URING_READ_DEPTH; i++)
+      if (reads[i].size != 0)
+        active++;
+
+    if (active == 0 && size == 0)
+      break;
+
+    reap(1);
+
+    if (error != 0)
+    {
+      /* let the other reads finish before the buffer goes away */
+      while (in_flight > 0)
+        reap(1);
+      error = 0;
+      throw runtime_error("Could not read file: " + filename);
+    }
+  }
+}
+#endif
+
+CryptoLog::Sink* CryptoLog::uring_sink()
+{
+#if CRYPTOLOG_HAVE_URING
+  try
+  {
+    return new UringSink;
+  }
+  catch (const runtime_error &)
+  {
+  }
+#endif
+  return default_sink();
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "Log.h"
+
+namespace CryptoLog {
+  typedef Log<XTEA, CTR> XTEA_CTR;
+}
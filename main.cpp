@@ -3,6 +3,7 @@
 #include "CryptoLog/Blowfish_CFB.h"
 #include "CryptoLog/Blowfish_CTR.h"
 #include "CryptoLog/XTEA_CBC.h"
+#include "CryptoLog/XTEA_CTR.h"
 using namespace std;
 
 int main()
@@ -42,6 +43,12 @@ int main()
     log_xtea.write("The quick brown fox jumps over the lazy dog");
     cout << log_xtea.get_plain_text() << endl;
 
+    /* XTEA CTR mode */
+    CryptoLog::XTEA_CTR log_xtea_ctr("xteactr.log", key);
+
+    log_xtea_ctr.write("The quick brown fox jumps over the lazy dog");
+    cout << log_xtea_ctr.get_plain_text() << endl;
+
     return 0;
   }
   catch (exception &e)
@@ -48,6 +48,7 @@ typedef UINT32 uint32_t;
 #define BLOWFISH_MIN_KEY     32
 #define BLOWFISH_ROUNDS      16         /**< Rounds to use. When increasing this value, make sure to extend the initialisation vectors */
 #define BLOWFISH_BLOCKSIZE   8          /* Blowfish uses 64 bit blocks */
+#define BLOWFISH_PARALLEL_BLOCKS 16     /**< Blocks handed to the multi-block kernel per call by the CBC/CTR modes */
 
 #define POLARSSL_ERR_BLOWFISH_INVALID_KEY_LENGTH                -0x0016  /**< Invalid key length. */
 #define POLARSSL_ERR_BLOWFISH_INVALID_INPUT_LENGTH              -0x0018  /**< Invalid data input length. */
@@ -111,6 +112,25 @@ int blowfish_crypt_ecb( blowfish_context *ctx,
                         const unsigned char input[BLOWFISH_BLOCKSIZE],
                         unsigned char output[BLOWFISH_BLOCKSIZE] );
 
+/**
+ * \brief          Blowfish-ECB encryption/decryption of several blocks
+ *                 Blocks are processed independently and interleaved
+ *                 to hide the S-box load latency.
+ *
+ * \param ctx      Blowfish context
+ * \param mode     BLOWFISH_ENCRYPT or BLOWFISH_DECRYPT
+ * \param nblocks  number of 8-byte blocks
+ * \param input    buffer holding nblocks input blocks
+ * \param output   buffer holding nblocks output blocks (may equal input)
+ *
+ * \return         0 if successful
+ */
+int blowfish_crypt_ecb_blocks( blowfish_context *ctx,
+                               int mode,
+                               size_t nblocks,
+                               const unsigned char *input,
+                               unsigned char *output );
+
 #if defined(POLARSSL_CIPHER_MODE_CBC)
 /**
  * \brief          Blowfish-CBC buffer encryption/decryption
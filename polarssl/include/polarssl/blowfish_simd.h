@@ -0,0 +1,68 @@
+/**
+ * \file blowfish_simd.h
+ *
+ * \brief AVX2 / AVX-512 multi-block Blowfish kernels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_BLOWFISH_SIMD_H
+#define POLARSSL_BLOWFISH_SIMD_H
+
+#include "blowfish.h"
+
+#if defined(POLARSSL_HAVE_ASM) && defined(__GNUC__) &&  \
+    ( defined(__amd64__) || defined(__x86_64__) )   &&  \
+    ! defined(POLARSSL_HAVE_X86_64)
+#define POLARSSL_HAVE_X86_64
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Number of blocks the best kernel supported by the
+ *                 running CPU handles per call (16 for AVX-512, 8 for
+ *                 AVX2), or 0 if only the scalar code is usable.
+ *                 The CPU is queried once and the answer is cached.
+ *
+ * \return         the lane count, or 0
+ */
+int blowfish_simd_lanes( void );
+
+/**
+ * \brief          Blowfish-ECB encryption/decryption of as many whole
+ *                 lane groups of blocks as fit in nblocks. The remaining
+ *                 blocks are left to the caller.
+ *
+ * \param ctx      Blowfish context
+ * \param mode     BLOWFISH_ENCRYPT or BLOWFISH_DECRYPT
+ * \param nblocks  number of 8-byte blocks available
+ * \param input    buffer holding the input blocks
+ * \param output   buffer holding the output blocks (may equal input)
+ *
+ * \return         number of blocks processed (0 if no kernel is usable)
+ */
+size_t blowfish_simd_crypt_ecb_blocks( blowfish_context *ctx,
+                                       int mode,
+                                       size_t nblocks,
+                                       const unsigned char *input,
+                                       unsigned char *output );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* blowfish_simd.h */
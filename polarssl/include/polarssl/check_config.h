@@ -37,6 +37,11 @@
 #error "POLARSSL_AESNI_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_BLOWFISH_SIMD_C) && ( !defined(POLARSSL_BLOWFISH_C) || \
+    !defined(POLARSSL_HAVE_ASM) )
+#error "POLARSSL_BLOWFISH_SIMD_C defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_CERTS_C) && !defined(POLARSSL_PEM_PARSE_C)
 #error "POLARSSL_CERTS_C defined, but not all prerequisites"
 #endif
@@ -323,4 +328,9 @@
 #error "POLARSSL_X509_CSR_WRITE_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_XTEA_SIMD_C) && ( !defined(POLARSSL_XTEA_C) || \
+    !defined(POLARSSL_HAVE_ASM) )
+#error "POLARSSL_XTEA_SIMD_C defined, but not all prerequisites"
+#endif
+
 #endif /* POLARSSL_CHECK_CONFIG_H */
@@ -1250,6 +1250,21 @@
  */
 #define POLARSSL_BLOWFISH_C
 
+/**
+ * \def POLARSSL_BLOWFISH_SIMD_C
+ *
+ * Enable the AVX2 / AVX-512 Blowfish kernels on x86-64.
+ *
+ * Module:  library/blowfish_simd.c
+ * Caller:  library/blowfish.c
+ *
+ * Requires: POLARSSL_BLOWFISH_C, POLARSSL_HAVE_ASM
+ *
+ * The kernel is picked at runtime from the CPU features; the scalar code
+ * is used on CPUs and platforms without them.
+ */
+#define POLARSSL_BLOWFISH_SIMD_C
+
 /**
  * \def POLARSSL_CAMELLIA_C
  *
@@ -2094,6 +2109,21 @@
  */
 #define POLARSSL_XTEA_C
 
+/**
+ * \def POLARSSL_XTEA_SIMD_C
+ *
+ * Enable the SSE2 / AVX2 / AVX-512 XTEA kernels on x86-64.
+ *
+ * Module:  library/xtea_simd.c
+ * Caller:  library/xtea.c
+ *
+ * Requires: POLARSSL_XTEA_C, POLARSSL_HAVE_ASM
+ *
+ * The kernel is picked at runtime from the CPU features; the scalar code
+ * is used on platforms without them.
+ */
+#define POLARSSL_XTEA_SIMD_C
+
 /* \} name SECTION: PolarSSL modules */
 
 /**
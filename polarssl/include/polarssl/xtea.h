@@ -44,6 +44,7 @@ typedef UINT32 uint32_t;
 
 #define XTEA_ENCRYPT     1
 #define XTEA_DECRYPT     0
+#define XTEA_PARALLEL_BLOCKS 16     /**< Blocks handed to the multi-block kernel per call by the CBC/CTR modes */
 
 #define POLARSSL_ERR_XTEA_INVALID_INPUT_LENGTH             -0x0028  /**< The data input has an invalid length. */
 
@@ -61,6 +62,7 @@ extern "C" {
 typedef struct
 {
     uint32_t k[4];       /*!< key */
+    uint32_t rk[64];     /*!< round keys: sum + k[...] of every half round */
 }
 xtea_context;
 
@@ -79,7 +81,7 @@ void xtea_init( xtea_context *ctx );
 void xtea_free( xtea_context *ctx );
 
 /**
- * \brief          XTEA key schedule
+ * \brief          XTEA key schedule, including the expanded round keys
  *
  * \param ctx      XTEA context to be initialized
  * \param key      the secret key
@@ -101,6 +103,23 @@ int xtea_crypt_ecb( xtea_context *ctx,
                     const unsigned char input[8],
                     unsigned char output[8] );
 
+/**
+ * \brief          XTEA cipher function for several independent blocks
+ *
+ * \param ctx      XTEA context
+ * \param mode     XTEA_ENCRYPT or XTEA_DECRYPT
+ * \param nblocks  number of 8-byte blocks
+ * \param input    buffer holding nblocks input blocks
+ * \param output   buffer holding nblocks output blocks (may equal input)
+ *
+ * \return         0 if successful
+ */
+int xtea_crypt_ecb_blocks( xtea_context *ctx,
+                           int mode,
+                           size_t nblocks,
+                           const unsigned char *input,
+                           unsigned char *output );
+
 #if defined(POLARSSL_CIPHER_MODE_CBC)
 /**
  * \brief          XTEA CBC cipher function
@@ -123,6 +142,34 @@ int xtea_crypt_cbc( xtea_context *ctx,
                     unsigned char *output);
 #endif /* POLARSSL_CIPHER_MODE_CBC */
 
+#if defined(POLARSSL_CIPHER_MODE_CTR)
+/**
+ * \brief               XTEA-CTR buffer encryption/decryption
+ *
+ * Warning: You have to keep the maximum use of your counter in mind!
+ *
+ * \param ctx           XTEA context
+ * \param length        The length of the data
+ * \param nc_off        The offset in the current stream_block (for resuming
+ *                      within current cipher stream). The offset pointer to
+ *                      should be 0 at the start of a stream.
+ * \param nonce_counter The 64-bit nonce and counter.
+ * \param stream_block  The saved stream-block for resuming. Is overwritten
+ *                      by the function.
+ * \param input         The input data stream
+ * \param output        The output data stream
+ *
+ * \return         0 if successful
+ */
+int xtea_crypt_ctr( xtea_context *ctx,
+                    size_t length,
+                    size_t *nc_off,
+                    unsigned char nonce_counter[8],
+                    unsigned char stream_block[8],
+                    const unsigned char *input,
+                    unsigned char *output );
+#endif /* POLARSSL_CIPHER_MODE_CTR */
+
 #ifdef __cplusplus
 }
 #endif
@@ -39,6 +39,10 @@
 
 #include "polarssl/blowfish.h"
 
+#if defined(POLARSSL_BLOWFISH_SIMD_C)
+#include "polarssl/blowfish_simd.h"
+#endif
+
 #if !defined(POLARSSL_BLOWFISH_ALT)
 
 /* Implementation that should never be optimized out by the compiler */
@@ -77,6 +81,31 @@ static const uint32_t P[BLOWFISH_ROUNDS + 2] = {
         0x9216D5D9L, 0x8979FB1BL
 };
 
+/*
+ * output = a ^ b, a machine word at a time (any of them may alias)
+ */
+static void blowfish_xor( unsigned char *output, const unsigned char *a,
+                          const unsigned char *b, size_t length )
+{
+    size_t x, y;
+
+    while( length >= sizeof( size_t ) )
+    {
+        memcpy( &x, a, sizeof( size_t ) );
+        memcpy( &y, b, sizeof( size_t ) );
+        x ^= y;
+        memcpy( output, &x, sizeof( size_t ) );
+
+        output += sizeof( size_t );
+        a      += sizeof( size_t );
+        b      += sizeof( size_t );
+        length -= sizeof( size_t );
+    }
+
+    while( length-- )
+        *output++ = (unsigned char)( *a++ ^ *b++ );
+}
+
 /* declarations of data at the end of this file */
 static const uint32_t S[4][256];
 
@@ -157,6 +186,64 @@ static void blowfish_dec( blowfish_context *ctx, uint32_t *xl, uint32_t *xr )
     *xr = Xr;
 }
 
+/*
+ * Interleaved variants of blowfish_enc()/blowfish_dec(): four independent
+ * blocks go through every round together, so the S-box loads of one block
+ * overlap with those of the others instead of waiting on the previous round.
+ * Two rounds per iteration avoid the Xl/Xr swap.
+ */
+static void blowfish_enc_x4( blowfish_context *ctx, uint32_t xl[4], uint32_t xr[4] )
+{
+    uint32_t  l0, l1, l2, l3, r0, r1, r2, r3;
+    short i;
+
+    l0 = xl[0]; l1 = xl[1]; l2 = xl[2]; l3 = xl[3];
+    r0 = xr[0]; r1 = xr[1]; r2 = xr[2]; r3 = xr[3];
+
+    for( i = 0; i < BLOWFISH_ROUNDS; i += 2 )
+    {
+        l0 ^= ctx->P[i]; l1 ^= ctx->P[i]; l2 ^= ctx->P[i]; l3 ^= ctx->P[i];
+        r0 ^= F( ctx, l0 ); r1 ^= F( ctx, l1 );
+        r2 ^= F( ctx, l2 ); r3 ^= F( ctx, l3 );
+
+        r0 ^= ctx->P[i + 1]; r1 ^= ctx->P[i + 1];
+        r2 ^= ctx->P[i + 1]; r3 ^= ctx->P[i + 1];
+        l0 ^= F( ctx, r0 ); l1 ^= F( ctx, r1 );
+        l2 ^= F( ctx, r2 ); l3 ^= F( ctx, r3 );
+    }
+
+    xl[0] = r0 ^ ctx->P[BLOWFISH_ROUNDS + 1]; xr[0] = l0 ^ ctx->P[BLOWFISH_ROUNDS];
+    xl[1] = r1 ^ ctx->P[BLOWFISH_ROUNDS + 1]; xr[1] = l1 ^ ctx->P[BLOWFISH_ROUNDS];
+    xl[2] = r2 ^ ctx->P[BLOWFISH_ROUNDS + 1]; xr[2] = l2 ^ ctx->P[BLOWFISH_ROUNDS];
+    xl[3] = r3 ^ ctx->P[BLOWFISH_ROUNDS + 1]; xr[3] = l3 ^ ctx->P[BLOWFISH_ROUNDS];
+}
+
+static void blowfish_dec_x4( blowfish_context *ctx, uint32_t xl[4], uint32_t xr[4] )
+{
+    uint32_t  l0, l1, l2, l3, r0, r1, r2, r3;
+    short i;
+
+    l0 = xl[0]; l1 = xl[1]; l2 = xl[2]; l3 = xl[3];
+    r0 = xr[0]; r1 = xr[1]; r2 = xr[2]; r3 = xr[3];
+
+    for( i = BLOWFISH_ROUNDS + 1; i > 1; i -= 2 )
+    {
+        l0 ^= ctx->P[i]; l1 ^= ctx->P[i]; l2 ^= ctx->P[i]; l3 ^= ctx->P[i];
+        r0 ^= F( ctx, l0 ); r1 ^= F( ctx, l1 );
+        r2 ^= F( ctx, l2 ); r3 ^= F( ctx, l3 );
+
+        r0 ^= ctx->P[i - 1]; r1 ^= ctx->P[i - 1];
+        r2 ^= ctx->P[i - 1]; r3 ^= ctx->P[i - 1];
+        l0 ^= F( ctx, r0 ); l1 ^= F( ctx, r1 );
+        l2 ^= F( ctx, r2 ); l3 ^= F( ctx, r3 );
+    }
+
+    xl[0] = r0 ^ ctx->P[0]; xr[0] = l0 ^ ctx->P[1];
+    xl[1] = r1 ^ ctx->P[0]; xr[1] = l1 ^ ctx->P[1];
+    xl[2] = r2 ^ ctx->P[0]; xr[2] = l2 ^ ctx->P[1];
+    xl[3] = r3 ^ ctx->P[0]; xr[3] = l3 ^ ctx->P[1];
+}
+
 void blowfish_init( blowfish_context *ctx )
 {
     memset( ctx, 0, sizeof( blowfish_context ) );
@@ -256,6 +343,63 @@ int blowfish_crypt_ecb( blowfish_context *ctx,
     return( 0 );
 }
 
+/*
+ * Blowfish-ECB encryption/decryption of several independent blocks
+ */
+int blowfish_crypt_ecb_blocks( blowfish_context *ctx,
+                               int mode,
+                               size_t nblocks,
+                               const unsigned char *input,
+                               unsigned char *output )
+{
+    uint32_t Xl[4], Xr[4];
+    int j;
+#if defined(POLARSSL_BLOWFISH_SIMD_C)
+    size_t done;
+
+    done = blowfish_simd_crypt_ecb_blocks( ctx, mode, nblocks, input, output );
+
+    input   += done * BLOWFISH_BLOCKSIZE;
+    output  += done * BLOWFISH_BLOCKSIZE;
+    nblocks -= done;
+#endif
+
+    while( nblocks >= 4 )
+    {
+        for( j = 0; j < 4; j++ )
+        {
+            GET_UINT32_BE( Xl[j], input, j * BLOWFISH_BLOCKSIZE     );
+            GET_UINT32_BE( Xr[j], input, j * BLOWFISH_BLOCKSIZE + 4 );
+        }
+
+        if( mode == BLOWFISH_DECRYPT )
+            blowfish_dec_x4( ctx, Xl, Xr );
+        else /* BLOWFISH_ENCRYPT */
+            blowfish_enc_x4( ctx, Xl, Xr );
+
+        for( j = 0; j < 4; j++ )
+        {
+            PUT_UINT32_BE( Xl[j], output, j * BLOWFISH_BLOCKSIZE     );
+            PUT_UINT32_BE( Xr[j], output, j * BLOWFISH_BLOCKSIZE + 4 );
+        }
+
+        input   += 4 * BLOWFISH_BLOCKSIZE;
+        output  += 4 * BLOWFISH_BLOCKSIZE;
+        nblocks -= 4;
+    }
+
+    while( nblocks > 0 )
+    {
+        blowfish_crypt_ecb( ctx, mode, input, output );
+
+        input   += BLOWFISH_BLOCKSIZE;
+        output  += BLOWFISH_BLOCKSIZE;
+        nblocks -= 1;
+    }
+
+    return( 0 );
+}
+
 #if defined(POLARSSL_CIPHER_MODE_CBC)
 /*
  * Blowfish-CBC buffer encryption/decryption
@@ -268,26 +412,40 @@ int blowfish_crypt_cbc( blowfish_context *ctx,
                     unsigned char *output )
 {
     int i;
-    unsigned char temp[BLOWFISH_BLOCKSIZE];
 
     if( length % BLOWFISH_BLOCKSIZE )
         return( POLARSSL_ERR_BLOWFISH_INVALID_INPUT_LENGTH );
 
     if( mode == BLOWFISH_DECRYPT )
     {
+        /*
+         * Every block only depends on the previous ciphertext block, so
+         * decrypt a batch at once and chain the XOR afterwards. The batch
+         * is copied first because input and output may be the same buffer.
+         */
+        unsigned char batch[BLOWFISH_BLOCKSIZE * BLOWFISH_PARALLEL_BLOCKS];
+        size_t nblocks, n;
+
         while( length > 0 )
         {
-            memcpy( temp, input, BLOWFISH_BLOCKSIZE );
-            blowfish_crypt_ecb( ctx, mode, input, output );
+            nblocks = length / BLOWFISH_BLOCKSIZE;
+            if( nblocks > BLOWFISH_PARALLEL_BLOCKS )
+                nblocks = BLOWFISH_PARALLEL_BLOCKS;
+            n = nblocks * BLOWFISH_BLOCKSIZE;
 
-            for( i = 0; i < BLOWFISH_BLOCKSIZE;i++ )
-                output[i] = (unsigned char)( output[i] ^ iv[i] );
+            memcpy( batch, input, n );
+            blowfish_crypt_ecb_blocks( ctx, mode, nblocks, batch, output );
 
-            memcpy( iv, temp, BLOWFISH_BLOCKSIZE );
+            blowfish_xor( output, output, iv, BLOWFISH_BLOCKSIZE );
+            blowfish_xor( output + BLOWFISH_BLOCKSIZE,
+                          output + BLOWFISH_BLOCKSIZE, batch,
+                          n - BLOWFISH_BLOCKSIZE );
 
-            input  += BLOWFISH_BLOCKSIZE;
-            output += BLOWFISH_BLOCKSIZE;
-            length -= BLOWFISH_BLOCKSIZE;
+            memcpy( iv, batch + n - BLOWFISH_BLOCKSIZE, BLOWFISH_BLOCKSIZE );
+
+            input  += n;
+            output += n;
+            length -= n;
         }
     }
     else
@@ -327,6 +485,47 @@ int blowfish_crypt_cfb64( blowfish_context *ctx,
 
     if( mode == BLOWFISH_DECRYPT )
     {
+        unsigned char batch[BLOWFISH_BLOCKSIZE * BLOWFISH_PARALLEL_BLOCKS];
+        size_t nblocks;
+
+        /* finish the current block */
+        while( n != 0 && length > 0 )
+        {
+            c = *input++;
+            *output++ = (unsigned char)( c ^ iv[n] );
+            iv[n] = (unsigned char) c;
+
+            n = ( n + 1 ) % BLOWFISH_BLOCKSIZE;
+            length--;
+        }
+
+        /*
+         * Whole blocks: the keystream of every block is the encryption of
+         * the previous ciphertext block, all of which are already known.
+         */
+        while( length >= BLOWFISH_BLOCKSIZE )
+        {
+            nblocks = length / BLOWFISH_BLOCKSIZE;
+            if( nblocks > BLOWFISH_PARALLEL_BLOCKS )
+                nblocks = BLOWFISH_PARALLEL_BLOCKS;
+
+            memcpy( batch, iv, BLOWFISH_BLOCKSIZE );
+            memcpy( batch + BLOWFISH_BLOCKSIZE, input,
+                    ( nblocks - 1 ) * BLOWFISH_BLOCKSIZE );
+            memcpy( iv, input + ( nblocks - 1 ) * BLOWFISH_BLOCKSIZE,
+                    BLOWFISH_BLOCKSIZE );
+
+            blowfish_crypt_ecb_blocks( ctx, BLOWFISH_ENCRYPT, nblocks, batch,
+                                       batch );
+
+            blowfish_xor( output, input, batch,
+                          nblocks * BLOWFISH_BLOCKSIZE );
+
+            input  += nblocks * BLOWFISH_BLOCKSIZE;
+            output += nblocks * BLOWFISH_BLOCKSIZE;
+            length -= nblocks * BLOWFISH_BLOCKSIZE;
+        }
+
         while( length-- )
         {
             if( n == 0 )
@@ -370,25 +569,72 @@ int blowfish_crypt_ctr( blowfish_context *ctx,
                        const unsigned char *input,
                        unsigned char *output )
 {
-    int c, i;
-    size_t n = *nc_off;
+    int c;
+    uint32_t hi, lo;
+    size_t n = *nc_off, nblocks, j, chunk;
+    unsigned char batch[BLOWFISH_BLOCKSIZE * BLOWFISH_PARALLEL_BLOCKS];
 
-    while( length-- )
+    /* use up what is left of the saved stream block */
+    while( n != 0 && length > 0 )
     {
-        if( n == 0 ) {
-            blowfish_crypt_ecb( ctx, BLOWFISH_ENCRYPT, nonce_counter,
-                                stream_block );
-
-            for( i = BLOWFISH_BLOCKSIZE; i > 0; i-- )
-                if( ++nonce_counter[i - 1] != 0 )
-                    break;
-        }
         c = *input++;
         *output++ = (unsigned char)( c ^ stream_block[n] );
 
         n = ( n + 1 ) % BLOWFISH_BLOCKSIZE;
+        length--;
+    }
+
+    if( length == 0 )
+    {
+        *nc_off = n;
+        return( 0 );
+    }
+
+    /*
+     * From a block boundary on: generate a batch of keystream blocks per
+     * kernel call and XOR it in a word at a time. The counter is kept as
+     * a 64-bit big endian integer in two halves instead of bumping it
+     * byte by byte.
+     */
+    GET_UINT32_BE( hi, nonce_counter, 0 );
+    GET_UINT32_BE( lo, nonce_counter, 4 );
+
+    while( length > 0 )
+    {
+        nblocks = ( length + BLOWFISH_BLOCKSIZE - 1 ) / BLOWFISH_BLOCKSIZE;
+        if( nblocks > BLOWFISH_PARALLEL_BLOCKS )
+            nblocks = BLOWFISH_PARALLEL_BLOCKS;
+
+        for( j = 0; j < nblocks; j++ )
+        {
+            PUT_UINT32_BE( hi, batch, j * BLOWFISH_BLOCKSIZE     );
+            PUT_UINT32_BE( lo, batch, j * BLOWFISH_BLOCKSIZE + 4 );
+
+            if( ++lo == 0 )
+                ++hi;
+        }
+
+        blowfish_crypt_ecb_blocks( ctx, BLOWFISH_ENCRYPT, nblocks, batch,
+                                   batch );
+
+        chunk = nblocks * BLOWFISH_BLOCKSIZE;
+        if( chunk > length )
+            chunk = length;
+
+        blowfish_xor( output, input, batch, chunk );
+
+        memcpy( stream_block, batch + ( nblocks - 1 ) * BLOWFISH_BLOCKSIZE,
+                BLOWFISH_BLOCKSIZE );
+        n = chunk % BLOWFISH_BLOCKSIZE;
+
+        input  += chunk;
+        output += chunk;
+        length -= chunk;
     }
 
+    PUT_UINT32_BE( hi, nonce_counter, 0 );
+    PUT_UINT32_BE( lo, nonce_counter, 4 );
+
     *nc_off = n;
 
     return( 0 );
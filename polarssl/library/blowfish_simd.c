@@ -0,0 +1,252 @@
+/*
+ *  AVX2 / AVX-512 multi-block Blowfish kernels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  Every lane of a vector register carries one block. The four S-box
+ *  lookups of a round become four vpgatherdd with ctx->S as the base,
+ *  so 8 (AVX2) or 16 (AVX-512) blocks advance through a round at once.
+ */
+
+#if !defined(POLARSSL_CONFIG_FILE)
+#include "polarssl/config.h"
+#else
+#include POLARSSL_CONFIG_FILE
+#endif
+
+#if defined(POLARSSL_BLOWFISH_SIMD_C)
+
+#include "polarssl/blowfish_simd.h"
+
+#if defined(POLARSSL_HAVE_X86_64)
+
+#include <immintrin.h>
+
+/*
+ * 32-bit integer manipulation macros (big endian)
+ */
+#ifndef GET_UINT32_BE
+#define GET_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ] << 24 )             \
+        | ( (uint32_t) (b)[(i) + 1] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 2] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 3]       );            \
+}
+#endif
+
+#ifndef PUT_UINT32_BE
+#define PUT_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (unsigned char) ( (n) >> 24 );       \
+    (b)[(i) + 1] = (unsigned char) ( (n) >> 16 );       \
+    (b)[(i) + 2] = (unsigned char) ( (n) >>  8 );       \
+    (b)[(i) + 3] = (unsigned char) ( (n)       );       \
+}
+#endif
+
+#define BLOWFISH_SIMD_MAX_LANES 16
+
+__attribute__((target("avx2")))
+static __m256i F_avx2( const blowfish_context *ctx, __m256i x )
+{
+    const __m256i mask = _mm256_set1_epi32( 0xFF );
+    __m256i a, b, c, d, y;
+
+    a = _mm256_srli_epi32( x, 24 );
+    b = _mm256_and_si256( _mm256_srli_epi32( x, 16 ), mask );
+    c = _mm256_and_si256( _mm256_srli_epi32( x,  8 ), mask );
+    d = _mm256_and_si256( x, mask );
+
+    y = _mm256_add_epi32( _mm256_i32gather_epi32( (const int *) ctx->S[0], a, 4 ),
+                          _mm256_i32gather_epi32( (const int *) ctx->S[1], b, 4 ) );
+    y = _mm256_xor_si256( y, _mm256_i32gather_epi32( (const int *) ctx->S[2], c, 4 ) );
+    y = _mm256_add_epi32( y, _mm256_i32gather_epi32( (const int *) ctx->S[3], d, 4 ) );
+
+    return( y );
+}
+
+/*
+ * Two rounds per iteration avoid the Xl/Xr swap; decryption walks the
+ * round keys backwards.
+ */
+__attribute__((target("avx2")))
+static void blowfish_avx2_x8( const blowfish_context *ctx, int mode,
+                              uint32_t xl[8], uint32_t xr[8] )
+{
+    __m256i l, r;
+    int i, p, step;
+
+    p    = ( mode == BLOWFISH_DECRYPT ) ? BLOWFISH_ROUNDS + 1 : 0;
+    step = ( mode == BLOWFISH_DECRYPT ) ? -1 : 1;
+
+    l = _mm256_loadu_si256( (const __m256i *) xl );
+    r = _mm256_loadu_si256( (const __m256i *) xr );
+
+    for( i = 0; i < BLOWFISH_ROUNDS; i += 2 )
+    {
+        l = _mm256_xor_si256( l, _mm256_set1_epi32( ctx->P[p] ) );
+        r = _mm256_xor_si256( r, F_avx2( ctx, l ) );
+        p += step;
+
+        r = _mm256_xor_si256( r, _mm256_set1_epi32( ctx->P[p] ) );
+        l = _mm256_xor_si256( l, F_avx2( ctx, r ) );
+        p += step;
+    }
+
+    _mm256_storeu_si256( (__m256i *) xl,
+                         _mm256_xor_si256( r, _mm256_set1_epi32( ctx->P[p + step] ) ) );
+    _mm256_storeu_si256( (__m256i *) xr,
+                         _mm256_xor_si256( l, _mm256_set1_epi32( ctx->P[p] ) ) );
+}
+
+__attribute__((target("avx512f")))
+static __m512i F_avx512( const blowfish_context *ctx, __m512i x )
+{
+    const __m512i mask = _mm512_set1_epi32( 0xFF );
+    __m512i a, b, c, d, y;
+
+    a = _mm512_srli_epi32( x, 24 );
+    b = _mm512_and_si512( _mm512_srli_epi32( x, 16 ), mask );
+    c = _mm512_and_si512( _mm512_srli_epi32( x,  8 ), mask );
+    d = _mm512_and_si512( x, mask );
+
+    y = _mm512_add_epi32( _mm512_i32gather_epi32( a, (const void *) ctx->S[0], 4 ),
+                          _mm512_i32gather_epi32( b, (const void *) ctx->S[1], 4 ) );
+    y = _mm512_xor_si512( y, _mm512_i32gather_epi32( c, (const void *) ctx->S[2], 4 ) );
+    y = _mm512_add_epi32( y, _mm512_i32gather_epi32( d, (const void *) ctx->S[3], 4 ) );
+
+    return( y );
+}
+
+__attribute__((target("avx512f")))
+static void blowfish_avx512_x16( const blowfish_context *ctx, int mode,
+                                 uint32_t xl[16], uint32_t xr[16] )
+{
+    __m512i l, r;
+    int i, p, step;
+
+    p    = ( mode == BLOWFISH_DECRYPT ) ? BLOWFISH_ROUNDS + 1 : 0;
+    step = ( mode == BLOWFISH_DECRYPT ) ? -1 : 1;
+
+    l = _mm512_loadu_si512( (const void *) xl );
+    r = _mm512_loadu_si512( (const void *) xr );
+
+    for( i = 0; i < BLOWFISH_ROUNDS; i += 2 )
+    {
+        l = _mm512_xor_si512( l, _mm512_set1_epi32( ctx->P[p] ) );
+        r = _mm512_xor_si512( r, F_avx512( ctx, l ) );
+        p += step;
+
+        r = _mm512_xor_si512( r, _mm512_set1_epi32( ctx->P[p] ) );
+        l = _mm512_xor_si512( l, F_avx512( ctx, r ) );
+        p += step;
+    }
+
+    _mm512_storeu_si512( (void *) xl,
+                         _mm512_xor_si512( r, _mm512_set1_epi32( ctx->P[p + step] ) ) );
+    _mm512_storeu_si512( (void *) xr,
+                         _mm512_xor_si512( l, _mm512_set1_epi32( ctx->P[p] ) ) );
+}
+
+int blowfish_simd_lanes( void )
+{
+    /* cached with relaxed atomics: the kernels run on several threads */
+    static int cached = -1;
+    int lanes = __atomic_load_n( &cached, __ATOMIC_RELAXED );
+
+    if( lanes < 0 )
+    {
+        __builtin_cpu_init();
+
+        if( __builtin_cpu_supports( "avx512f" ) )
+            lanes = 16;
+        else if( __builtin_cpu_supports( "avx2" ) )
+            lanes = 8;
+        else
+            lanes = 0;
+
+        __atomic_store_n( &cached, lanes, __ATOMIC_RELAXED );
+    }
+
+    return( lanes );
+}
+
+size_t blowfish_simd_crypt_ecb_blocks( blowfish_context *ctx,
+                                       int mode,
+                                       size_t nblocks,
+                                       const unsigned char *input,
+                                       unsigned char *output )
+{
+    uint32_t Xl[BLOWFISH_SIMD_MAX_LANES], Xr[BLOWFISH_SIMD_MAX_LANES];
+    size_t done = 0;
+    int j, lanes = blowfish_simd_lanes();
+
+    if( lanes == 0 )
+        return( 0 );
+
+    while( nblocks - done >= (size_t) lanes )
+    {
+        for( j = 0; j < lanes; j++ )
+        {
+            GET_UINT32_BE( Xl[j], input, j * BLOWFISH_BLOCKSIZE     );
+            GET_UINT32_BE( Xr[j], input, j * BLOWFISH_BLOCKSIZE + 4 );
+        }
+
+        if( lanes == 16 )
+            blowfish_avx512_x16( ctx, mode, Xl, Xr );
+        else
+            blowfish_avx2_x8( ctx, mode, Xl, Xr );
+
+        for( j = 0; j < lanes; j++ )
+        {
+            PUT_UINT32_BE( Xl[j], output, j * BLOWFISH_BLOCKSIZE     );
+            PUT_UINT32_BE( Xr[j], output, j * BLOWFISH_BLOCKSIZE + 4 );
+        }
+
+        input  += lanes * BLOWFISH_BLOCKSIZE;
+        output += lanes * BLOWFISH_BLOCKSIZE;
+        done   += lanes;
+    }
+
+    return( done );
+}
+
+#else /* POLARSSL_HAVE_X86_64 */
+
+int blowfish_simd_lanes( void )
+{
+    return( 0 );
+}
+
+size_t blowfish_simd_crypt_ecb_blocks( blowfish_context *ctx,
+                                       int mode,
+                                       size_t nblocks,
+                                       const unsigned char *input,
+                                       unsigned char *output )
+{
+    ((void) ctx);
+    ((void) mode);
+    ((void) nblocks);
+    ((void) input);
+    ((void) output);
+
+    return( 0 );
+}
+
+#endif /* POLARSSL_HAVE_X86_64 */
+
+#endif /* POLARSSL_BLOWFISH_SIMD_C */
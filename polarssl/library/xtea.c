@@ -33,6 +33,10 @@
 
 #include "polarssl/xtea.h"
 
+#if defined(POLARSSL_XTEA_SIMD_C)
+#include "polarssl/xtea_simd.h"
+#endif
+
 #if defined(POLARSSL_PLATFORM_C)
 #include "polarssl/platform.h"
 #else
@@ -88,6 +92,7 @@ void xtea_free( xtea_context *ctx )
 void xtea_setup( xtea_context *ctx, const unsigned char key[16] )
 {
     int i;
+    uint32_t *k, sum = 0, delta = 0x9E3779B9;
 
     memset( ctx, 0, sizeof(xtea_context) );
 
@@ -95,6 +100,20 @@ void xtea_setup( xtea_context *ctx, const unsigned char key[16] )
     {
         GET_UINT32_BE( ctx->k[i], key, i << 2 );
     }
+
+    /*
+     * The key term of every half round only depends on the key, so
+     * compute all 64 of them once; rk[2i] and rk[2i + 1] are the v0 and
+     * v1 terms of round i.
+     */
+    k = ctx->k;
+
+    for( i = 0; i < 32; i++ )
+    {
+        ctx->rk[2 * i] = sum + k[sum & 3];
+        sum += delta;
+        ctx->rk[2 * i + 1] = sum + k[(sum>>11) & 3];
+    }
 }
 
 /*
@@ -103,33 +122,27 @@ void xtea_setup( xtea_context *ctx, const unsigned char key[16] )
 int xtea_crypt_ecb( xtea_context *ctx, int mode,
                     const unsigned char input[8], unsigned char output[8])
 {
-    uint32_t *k, v0, v1, i;
+    uint32_t *rk, v0, v1, i;
 
-    k = ctx->k;
+    rk = ctx->rk;
 
     GET_UINT32_BE( v0, input, 0 );
     GET_UINT32_BE( v1, input, 4 );
 
     if( mode == XTEA_ENCRYPT )
     {
-        uint32_t sum = 0, delta = 0x9E3779B9;
-
-        for( i = 0; i < 32; i++ )
+        for( i = 0; i < 64; i += 2 )
         {
-            v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
-            sum += delta;
-            v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum>>11) & 3]);
+            v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ rk[i];
+            v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ rk[i + 1];
         }
     }
     else /* XTEA_DECRYPT */
     {
-        uint32_t delta = 0x9E3779B9, sum = delta * 32;
-
-        for( i = 0; i < 32; i++ )
+        for( i = 64; i > 0; i -= 2 )
         {
-            v1 -= (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum>>11) & 3]);
-            sum -= delta;
-            v0 -= (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
+            v1 -= (((v0 << 4) ^ (v0 >> 5)) + v0) ^ rk[i - 1];
+            v0 -= (((v1 << 4) ^ (v1 >> 5)) + v1) ^ rk[i - 2];
         }
     }
 
@@ -139,6 +152,34 @@ int xtea_crypt_ecb( xtea_context *ctx, int mode,
     return( 0 );
 }
 
+/*
+ * XTEA encrypt function for several independent blocks
+ */
+int xtea_crypt_ecb_blocks( xtea_context *ctx, int mode, size_t nblocks,
+                           const unsigned char *input, unsigned char *output )
+{
+#if defined(POLARSSL_XTEA_SIMD_C)
+    size_t done;
+
+    done = xtea_simd_crypt_ecb_blocks( ctx, mode, nblocks, input, output );
+
+    input   += done * 8;
+    output  += done * 8;
+    nblocks -= done;
+#endif
+
+    while( nblocks > 0 )
+    {
+        xtea_crypt_ecb( ctx, mode, input, output );
+
+        input   += 8;
+        output  += 8;
+        nblocks -= 1;
+    }
+
+    return( 0 );
+}
+
 #if defined(POLARSSL_CIPHER_MODE_CBC)
 /*
  * XTEA-CBC buffer encryption/decryption
@@ -148,26 +189,40 @@ int xtea_crypt_cbc( xtea_context *ctx, int mode, size_t length,
                     unsigned char *output)
 {
     int i;
-    unsigned char temp[8];
 
     if( length % 8 )
         return( POLARSSL_ERR_XTEA_INVALID_INPUT_LENGTH );
 
     if( mode == XTEA_DECRYPT )
     {
+        /*
+         * Decrypt a batch of blocks at once and chain the XOR afterwards;
+         * the batch is copied first because input may equal output.
+         */
+        unsigned char batch[8 * XTEA_PARALLEL_BLOCKS];
+        size_t nblocks, n;
+
         while( length > 0 )
         {
-            memcpy( temp, input, 8 );
-            xtea_crypt_ecb( ctx, mode, input, output );
+            nblocks = length / 8;
+            if( nblocks > XTEA_PARALLEL_BLOCKS )
+                nblocks = XTEA_PARALLEL_BLOCKS;
+            n = nblocks * 8;
+
+            memcpy( batch, input, n );
+            xtea_crypt_ecb_blocks( ctx, mode, nblocks, batch, output );
 
             for( i = 0; i < 8; i++ )
                 output[i] = (unsigned char)( output[i] ^ iv[i] );
 
-            memcpy( iv, temp, 8 );
+            for( i = 8; i < (int) n; i++ )
+                output[i] = (unsigned char)( output[i] ^ batch[i - 8] );
 
-            input  += 8;
-            output += 8;
-            length -= 8;
+            memcpy( iv, batch + n - 8, 8 );
+
+            input  += n;
+            output += n;
+            length -= n;
         }
     }
     else
@@ -189,6 +244,108 @@ int xtea_crypt_cbc( xtea_context *ctx, int mode, size_t length,
     return( 0 );
 }
 #endif /* POLARSSL_CIPHER_MODE_CBC */
+
+#if defined(POLARSSL_CIPHER_MODE_CTR)
+/*
+ * output = a ^ b, a machine word at a time (any of them may alias)
+ */
+static void xtea_xor( unsigned char *output, const unsigned char *a,
+                      const unsigned char *b, size_t length )
+{
+    size_t x, y;
+
+    while( length >= sizeof( size_t ) )
+    {
+        memcpy( &x, a, sizeof( size_t ) );
+        memcpy( &y, b, sizeof( size_t ) );
+        x ^= y;
+        memcpy( output, &x, sizeof( size_t ) );
+
+        output += sizeof( size_t );
+        a      += sizeof( size_t );
+        b      += sizeof( size_t );
+        length -= sizeof( size_t );
+    }
+
+    while( length-- )
+        *output++ = (unsigned char)( *a++ ^ *b++ );
+}
+
+/*
+ * XTEA-CTR buffer encryption/decryption
+ */
+int xtea_crypt_ctr( xtea_context *ctx, size_t length, size_t *nc_off,
+                    unsigned char nonce_counter[8],
+                    unsigned char stream_block[8],
+                    const unsigned char *input, unsigned char *output )
+{
+    int c;
+    uint32_t hi, lo;
+    size_t n = *nc_off, nblocks, j, chunk;
+    unsigned char batch[8 * XTEA_PARALLEL_BLOCKS];
+
+    /* use up what is left of the saved stream block */
+    while( n != 0 && length > 0 )
+    {
+        c = *input++;
+        *output++ = (unsigned char)( c ^ stream_block[n] );
+
+        n = ( n + 1 ) % 8;
+        length--;
+    }
+
+    if( length == 0 )
+    {
+        *nc_off = n;
+        return( 0 );
+    }
+
+    /*
+     * From a block boundary on: encrypt a batch of counter blocks per
+     * kernel call, keeping the counter as a 64-bit big endian integer.
+     */
+    GET_UINT32_BE( hi, nonce_counter, 0 );
+    GET_UINT32_BE( lo, nonce_counter, 4 );
+
+    while( length > 0 )
+    {
+        nblocks = ( length + 7 ) / 8;
+        if( nblocks > XTEA_PARALLEL_BLOCKS )
+            nblocks = XTEA_PARALLEL_BLOCKS;
+
+        for( j = 0; j < nblocks; j++ )
+        {
+            PUT_UINT32_BE( hi, batch, j * 8     );
+            PUT_UINT32_BE( lo, batch, j * 8 + 4 );
+
+            if( ++lo == 0 )
+                ++hi;
+        }
+
+        xtea_crypt_ecb_blocks( ctx, XTEA_ENCRYPT, nblocks, batch, batch );
+
+        chunk = nblocks * 8;
+        if( chunk > length )
+            chunk = length;
+
+        xtea_xor( output, input, batch, chunk );
+
+        memcpy( stream_block, batch + ( nblocks - 1 ) * 8, 8 );
+        n = chunk % 8;
+
+        input  += chunk;
+        output += chunk;
+        length -= chunk;
+    }
+
+    PUT_UINT32_BE( hi, nonce_counter, 0 );
+    PUT_UINT32_BE( lo, nonce_counter, 4 );
+
+    *nc_off = n;
+
+    return( 0 );
+}
+#endif /* POLARSSL_CIPHER_MODE_CTR */
 #endif /* !POLARSSL_XTEA_ALT */
 
 #if defined(POLARSSL_SELF_TEST)
@@ -0,0 +1,226 @@
+/*
+ *  SSE2 / AVX2 / AVX-512 multi-block XTEA kernels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  XTEA is only add/shift/xor on two 32-bit words, so every lane of a
+ *  vector register carries one block and the (scalar) round key is
+ *  broadcast to all of them.
+ */
+
+#if !defined(POLARSSL_CONFIG_FILE)
+#include "polarssl/config.h"
+#else
+#include POLARSSL_CONFIG_FILE
+#endif
+
+#if defined(POLARSSL_XTEA_SIMD_C)
+
+#include "polarssl/xtea_simd.h"
+
+#if defined(POLARSSL_HAVE_X86_64)
+
+#include <immintrin.h>
+
+/*
+ * 32-bit integer manipulation macros (big endian)
+ */
+#ifndef GET_UINT32_BE
+#define GET_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ] << 24 )             \
+        | ( (uint32_t) (b)[(i) + 1] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 2] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 3]       );            \
+}
+#endif
+
+#ifndef PUT_UINT32_BE
+#define PUT_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (unsigned char) ( (n) >> 24 );       \
+    (b)[(i) + 1] = (unsigned char) ( (n) >> 16 );       \
+    (b)[(i) + 2] = (unsigned char) ( (n) >>  8 );       \
+    (b)[(i) + 3] = (unsigned char) ( (n)       );       \
+}
+#endif
+
+#define XTEA_SIMD_MAX_LANES 16
+
+/*
+ * The same rounds as xtea_crypt_ecb(), written with the add/sub/xor/shift/
+ * broadcast intrinsics of one vector width. The key terms come from the
+ * round-key table filled by xtea_setup().
+ */
+#define XTEA_SIMD_ROUNDS( ADD, SUB, XOR, SLL, SRL, SET1 )                   \
+{                                                                           \
+    uint32_t *rk = ctx->rk, i;                                              \
+                                                                            \
+    if( mode == XTEA_ENCRYPT )                                              \
+    {                                                                       \
+        for( i = 0; i < 64; i += 2 )                                        \
+        {                                                                   \
+            v0 = ADD( v0, XOR( ADD( XOR( SLL( v1, 4 ), SRL( v1, 5 ) ), v1 ),\
+                               SET1( (int) rk[i] ) ) );                     \
+            v1 = ADD( v1, XOR( ADD( XOR( SLL( v0, 4 ), SRL( v0, 5 ) ), v0 ),\
+                               SET1( (int) rk[i + 1] ) ) );                 \
+        }                                                                   \
+    }                                                                       \
+    else /* XTEA_DECRYPT */                                                 \
+    {                                                                       \
+        for( i = 64; i > 0; i -= 2 )                                        \
+        {                                                                   \
+            v1 = SUB( v1, XOR( ADD( XOR( SLL( v0, 4 ), SRL( v0, 5 ) ), v0 ),\
+                               SET1( (int) rk[i - 1] ) ) );                 \
+            v0 = SUB( v0, XOR( ADD( XOR( SLL( v1, 4 ), SRL( v1, 5 ) ), v1 ),\
+                               SET1( (int) rk[i - 2] ) ) );                 \
+        }                                                                   \
+    }                                                                       \
+}
+
+static void xtea_sse2_x4( xtea_context *ctx, int mode,
+                          uint32_t y[4], uint32_t z[4] )
+{
+    __m128i v0 = _mm_loadu_si128( (const __m128i *) y );
+    __m128i v1 = _mm_loadu_si128( (const __m128i *) z );
+
+    XTEA_SIMD_ROUNDS( _mm_add_epi32, _mm_sub_epi32, _mm_xor_si128,
+                      _mm_slli_epi32, _mm_srli_epi32, _mm_set1_epi32 );
+
+    _mm_storeu_si128( (__m128i *) y, v0 );
+    _mm_storeu_si128( (__m128i *) z, v1 );
+}
+
+__attribute__((target("avx2")))
+static void xtea_avx2_x8( xtea_context *ctx, int mode,
+                          uint32_t y[8], uint32_t z[8] )
+{
+    __m256i v0 = _mm256_loadu_si256( (const __m256i *) y );
+    __m256i v1 = _mm256_loadu_si256( (const __m256i *) z );
+
+    XTEA_SIMD_ROUNDS( _mm256_add_epi32, _mm256_sub_epi32,
+                      _mm256_xor_si256, _mm256_slli_epi32, _mm256_srli_epi32,
+                      _mm256_set1_epi32 );
+
+    _mm256_storeu_si256( (__m256i *) y, v0 );
+    _mm256_storeu_si256( (__m256i *) z, v1 );
+}
+
+__attribute__((target("avx512f")))
+static void xtea_avx512_x16( xtea_context *ctx, int mode,
+                             uint32_t y[16], uint32_t z[16] )
+{
+    __m512i v0 = _mm512_loadu_si512( (const void *) y );
+    __m512i v1 = _mm512_loadu_si512( (const void *) z );
+
+    XTEA_SIMD_ROUNDS( _mm512_add_epi32, _mm512_sub_epi32,
+                      _mm512_xor_si512, _mm512_slli_epi32, _mm512_srli_epi32,
+                      _mm512_set1_epi32 );
+
+    _mm512_storeu_si512( (void *) y, v0 );
+    _mm512_storeu_si512( (void *) z, v1 );
+}
+
+int xtea_simd_lanes( void )
+{
+    /* cached with relaxed atomics: the kernels run on several threads */
+    static int cached = -1;
+    int lanes = __atomic_load_n( &cached, __ATOMIC_RELAXED );
+
+    if( lanes < 0 )
+    {
+        __builtin_cpu_init();
+
+        if( __builtin_cpu_supports( "avx512f" ) )
+            lanes = 16;
+        else if( __builtin_cpu_supports( "avx2" ) )
+            lanes = 8;
+        else
+            lanes = 4;      /* SSE2 is part of x86-64 */
+
+        __atomic_store_n( &cached, lanes, __ATOMIC_RELAXED );
+    }
+
+    return( lanes );
+}
+
+size_t xtea_simd_crypt_ecb_blocks( xtea_context *ctx,
+                                   int mode,
+                                   size_t nblocks,
+                                   const unsigned char *input,
+                                   unsigned char *output )
+{
+    uint32_t Y[XTEA_SIMD_MAX_LANES], Z[XTEA_SIMD_MAX_LANES];
+    size_t done = 0;
+    int j, lanes = xtea_simd_lanes();
+
+    if( lanes == 0 )
+        return( 0 );
+
+    while( nblocks - done >= (size_t) lanes )
+    {
+        for( j = 0; j < lanes; j++ )
+        {
+            GET_UINT32_BE( Y[j], input, j * 8     );
+            GET_UINT32_BE( Z[j], input, j * 8 + 4 );
+        }
+
+        if( lanes == 16 )
+            xtea_avx512_x16( ctx, mode, Y, Z );
+        else if( lanes == 8 )
+            xtea_avx2_x8( ctx, mode, Y, Z );
+        else
+            xtea_sse2_x4( ctx, mode, Y, Z );
+
+        for( j = 0; j < lanes; j++ )
+        {
+            PUT_UINT32_BE( Y[j], output, j * 8     );
+            PUT_UINT32_BE( Z[j], output, j * 8 + 4 );
+        }
+
+        input  += lanes * 8;
+        output += lanes * 8;
+        done   += lanes;
+    }
+
+    return( done );
+}
+
+#else /* POLARSSL_HAVE_X86_64 */
+
+int xtea_simd_lanes( void )
+{
+    return( 0 );
+}
+
+size_t xtea_simd_crypt_ecb_blocks( xtea_context *ctx,
+                                   int mode,
+                                   size_t nblocks,
+                                   const unsigned char *input,
+                                   unsigned char *output )
+{
+    ((void) ctx);
+    ((void) mode);
+    ((void) nblocks);
+    ((void) input);
+    ((void) output);
+
+    return( 0 );
+}
+
+#endif /* POLARSSL_HAVE_X86_64 */
+
+#endif /* POLARSSL_XTEA_SIMD_C */